@@ -0,0 +1,1167 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+#include "db.h"
+
+/*
+    Benchmark harness which links the engine directly and runs one
+    workload against a fresh db file:
+        seq-insert, random-insert   insert --rows rows
+        sql-insert, prepared-insert insert --rows rows in order from 
+                                    statement text, compiled per row
+                                    or prepared once and bound
+        uniform-lookup, zipf-lookup run --ops point lookups
+        full-scan, range-scan       run --ops scans
+        filter-scan                 run --ops selects whose filter no 
+                                    row passes, through the executor,
+                                    on --scan-threads threads
+        concurrent-lookup           run --ops point lookups split over
+                                    --threads threads, while another
+                                    thread keeps inserting rows
+        snapshot-scan               run --ops range scans of snapshots
+                                    split over --threads threads, while
+                                    another thread keeps inserting rows,
+                                    in copy-on-write mode
+        server-lookup               run --ops point lookup requests
+                                    against a server started with
+                                    `db <file> --serve <path>`, whose
+                                    socket is given with --socket, over
+                                    --threads connections with up to
+                                    --pipeline requests in flight each
+    Lookup and scan workloads first load --rows sequential rows,
+    which is not measured. server-lookup loads them through the 
+    socket, rows already in its db failing as duplicates.
+*/
+
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear latency histogram in nanoseconds, within ~1.5% error
+struct Histogram_t {
+
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+
+};
+
+typedef struct Histogram_t Histogram;
+
+uint32_t histogram_bucket(uint64_t value) {
+
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    uint32_t magnitude = 63 - __builtin_clzll(value) - 5;
+    uint32_t sub_bucket = (value >> magnitude) & (HISTOGRAM_SUB_BUCKETS / 2 - 1);
+
+    return HISTOGRAM_SUB_BUCKETS + (magnitude - 1) * (HISTOGRAM_SUB_BUCKETS / 2) +
+           sub_bucket;
+
+}
+
+uint64_t histogram_bucket_value(uint32_t bucket) {
+
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    uint32_t magnitude = (bucket - HISTOGRAM_SUB_BUCKETS) /
+                         (HISTOGRAM_SUB_BUCKETS / 2) + 1;
+    uint32_t sub_bucket = (bucket - HISTOGRAM_SUB_BUCKETS) %
+                          (HISTOGRAM_SUB_BUCKETS / 2);
+
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS / 2 + sub_bucket) << magnitude;
+
+}
+
+void histogram_record(Histogram* histogram, uint64_t value) {
+
+    histogram->counts[histogram_bucket(value)] += 1;
+    histogram->total += 1;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+
+}
+
+void histogram_merge(Histogram* histogram, Histogram* other) {
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        histogram->counts[i] += other->counts[i];
+    }
+    histogram->total += other->total;
+
+    if (other->max > histogram->max) {
+        histogram->max = other->max;
+    }
+
+}
+
+uint64_t histogram_percentile(Histogram* histogram, double percentile) {
+
+    uint64_t rank = (uint64_t)ceil(histogram->total * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+
+        seen += histogram->counts[i];
+        if (seen >= rank && seen > 0) {
+            return histogram_bucket_value(i);
+        }
+
+    }
+
+    return histogram->max;
+
+}
+
+uint64_t now_ns() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+}
+
+/*
+    xorshift64* random numbers, deterministic for a given seed
+*/
+uint64_t random_state = 88172645463325252ull;
+
+uint64_t xorshift_next(uint64_t* state) {
+
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+
+}
+
+uint64_t next_random() {
+    return xorshift_next(&random_state);
+}
+
+double next_random_double() {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+    Zipfian generator over [0, n) after Gray et al., "Quickly
+    generating billion-record synthetic databases", as used by YCSB
+*/
+struct Zipfian_t {
+
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+
+};
+
+typedef struct Zipfian_t Zipfian;
+
+void zipfian_init(Zipfian* zipfian, uint64_t n, double theta) {
+
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    zipfian->n = n;
+    zipfian->theta = theta;
+    zipfian->alpha = 1.0 / (1.0 - theta);
+    zipfian->zetan = 0;
+
+    for (uint64_t i = 1; i <= n; i++) {
+        zipfian->zetan += 1.0 / pow((double)i, theta);
+    }
+
+    zipfian->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) /
+                   (1.0 - zeta2 / zipfian->zetan);
+
+}
+
+uint64_t zipfian_next(Zipfian* zipfian) {
+
+    double u = next_random_double();
+    double uz = u * zipfian->zetan;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, zipfian->theta)) {
+        return 1;
+    }
+
+    uint64_t value = (uint64_t)(zipfian->n *
+                     pow(zipfian->eta * u - zipfian->eta + 1.0, zipfian->alpha));
+
+    return value < zipfian->n ? value : zipfian->n - 1;
+
+}
+
+void fill_row(Row* row, uint32_t id) {
+
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "user%u@example.com", id);
+
+}
+
+ExecuteResult insert_row(Table* table, uint32_t id) {
+
+    Statement statement;
+    statement.type = STATEMENT_INSERT;
+    statement.rows_to_insert = &(statement.row_to_insert);
+    statement.num_rows = 1;
+    fill_row(&(statement.row_to_insert), id);
+
+    return execute_statement(&statement, table);
+
+}
+
+ExecuteResult insert_sql(Table* table, InputBuffer* input_buffer, uint32_t id) {
+
+    Statement statement;
+    input_buffer->input_length = sprintf(input_buffer->buffer, 
+                                         "insert %u user%u user%u@example.com",
+                                         id, id, id);
+
+    if (prepare_statement(input_buffer, &statement) != PREPARE_SUCCESS) {
+        return EXECUTE_INVALID_ROW;
+    }
+
+    ExecuteResult result = execute_statement(&statement, table);
+    close_statement(&statement);
+
+    return result;
+
+}
+
+ExecuteResult insert_prepared(Table* table, PreparedStatement* insert, uint32_t id) {
+
+    Row row;
+    fill_row(&row, id);
+
+    db_bind_id(insert, 0, row.id);
+    db_bind_text(insert, 1, row.username);
+    db_bind_text(insert, 2, row.email);
+
+    return db_execute(table, insert);
+
+}
+
+/*
+    Point lookup of a key, copying the row out like a select would
+*/
+bool lookup_row(Table* table, uint32_t id, Row* row) {
+
+    Cursor* cursor = table_find(table, id);
+    void* node = get_page(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) &&
+                 *leaf_node_key(node, cursor->cell_num) == id;
+
+    if (found) {
+        deserialize_row(leaf_node_value(node, cursor->cell_num), row);
+    }
+
+    free(cursor);
+    pager_commit(table->pager);
+
+    return found;
+
+}
+
+/*
+    Scan up to `limit` rows from `start_id`, returning the count
+*/
+uint32_t scan_rows(Table* table, uint32_t start_id, uint32_t limit) {
+
+    Row row;
+    uint32_t count = 0;
+    Cursor* cursor = table_seek(table, start_id);
+
+    while (!cursor->end_of_table && count < limit) {
+
+        deserialize_row(cursor_value(cursor), &row);
+        count += 1;
+        cursor_advance(cursor);
+
+    }
+
+    free(cursor);
+    pager_commit(table->pager);
+
+    return count;
+
+}
+
+/*
+    Select with a where clause no row passes, so the executor scans
+    the whole table but formats no output
+*/
+void filter_scan(Table* table) {
+
+    Statement statement;
+    statement.type = STATEMENT_SELECT;
+    statement.num_columns = 0;
+    statement.num_aggregates = 0;
+    statement.where_type = WHERE_COLUMN_EQUALS;
+    statement.where_column = COLUMN_EMAIL;
+    strcpy(statement.where_value, "nobody");
+
+    execute_statement(&statement, table);
+
+}
+
+// A reader thread of the concurrent-lookup and snapshot-scan workloads
+struct LookupThread_t {
+
+    pthread_t thread;
+    Table* table;
+    uint32_t rows;
+    uint32_t ops;
+    uint32_t range_length;
+    uint64_t random_state;
+    uint64_t found;
+    Histogram* histogram;
+
+};
+
+typedef struct LookupThread_t LookupThread;
+
+// The thread inserting rows while the lookups run
+struct InsertThread_t {
+
+    pthread_t thread;
+    Table* table;
+    uint32_t next_id;
+    uint64_t inserted;
+    bool stop;
+
+};
+
+typedef struct InsertThread_t InsertThread;
+
+void* lookup_thread(void* argument) {
+
+    LookupThread* worker = argument;
+    Row row;
+
+    for (uint32_t i = 0; i < worker->ops; i++) {
+
+        uint32_t id = xorshift_next(&worker->random_state) % worker->rows + 1;
+        uint64_t op_start = now_ns();
+        Cursor* cursor = db_cursor_open(worker->table, id);
+
+        if (!cursor->end_of_table && cursor_key(cursor) == id) {
+            deserialize_row(cursor_value(cursor), &row);
+            worker->found += 1;
+        }
+
+        cursor_close(cursor);
+        histogram_record(worker->histogram, now_ns() - op_start);
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Scans --range-length rows from a random key of the latest
+    snapshot. The rows were inserted in key order and none are
+    deleted, so a snapshot which does not hold consecutive keys
+    from the first one has seen a tree that was never published
+*/
+void* snapshot_thread(void* argument) {
+
+    LookupThread* worker = argument;
+
+    for (uint32_t i = 0; i < worker->ops; i++) {
+
+        uint32_t id = xorshift_next(&worker->random_state) % worker->rows + 1;
+        uint64_t op_start = now_ns();
+        Snapshot* snapshot = db_snapshot_open(worker->table);
+
+        if (snapshot == NULL) {
+            printf("No snapshot reader slot left.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        Cursor* cursor = snapshot_seek(snapshot, id);
+        uint32_t count = 0;
+
+        while (!cursor->end_of_table && count < worker->range_length) {
+
+            if (cursor_key(cursor) != id + count) {
+                printf("Snapshot scan from %u read %u after %u rows.\n",
+                       id, cursor_key(cursor), count);
+                exit(EXIT_FAILURE);
+            }
+
+            count += 1;
+            cursor_advance(cursor);
+
+        }
+
+        cursor_close(cursor);
+        db_snapshot_close(snapshot);
+
+        worker->found += count;
+        histogram_record(worker->histogram, now_ns() - op_start);
+
+    }
+
+    return NULL;
+
+}
+
+void* insert_thread(void* argument) {
+
+    InsertThread* writer = argument;
+    Row row;
+
+    while (!__atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE)) {
+
+        fill_row(&row, writer->next_id++);
+
+        if (db_insert(writer->table, &row) != EXECUTE_SUCCESS) {
+            printf("Insert of %u failed.\n", row.id);
+            exit(EXIT_FAILURE);
+        }
+
+        writer->inserted += 1;
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Run the lookups of concurrent-lookup, or the scans of 
+    snapshot-scan, with `reader` on `num_threads` threads against one
+    table, recording into one histogram per thread which are merged
+    into `histogram`. Returns the rows found.
+*/
+uint64_t run_concurrent_reads(Table* table, void* (*reader)(void*),
+                              uint32_t rows, uint32_t ops, 
+                              uint32_t range_length, uint32_t num_threads,
+                              Histogram* histogram, uint64_t* inserted) {
+
+    LookupThread* workers = calloc(num_threads, sizeof(LookupThread));
+    InsertThread writer = { .table = table, .next_id = rows + 1,
+                            .inserted = 0, .stop = false };
+    uint64_t found = 0;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+
+        workers[i].table = table;
+        workers[i].rows = rows;
+        workers[i].ops = ops / num_threads + (i < ops % num_threads);
+        workers[i].range_length = range_length;
+        workers[i].random_state = next_random() | 1;
+        workers[i].histogram = calloc(1, sizeof(Histogram));
+        pthread_create(&workers[i].thread, NULL, reader, &workers[i]);
+
+    }
+
+    pthread_create(&writer.thread, NULL, insert_thread, &writer);
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+
+        pthread_join(workers[i].thread, NULL);
+        found += workers[i].found;
+
+        histogram_merge(histogram, workers[i].histogram);
+        free(workers[i].histogram);
+
+    }
+
+    __atomic_store_n(&writer.stop, true, __ATOMIC_RELEASE);
+    pthread_join(writer.thread, NULL);
+    *inserted = writer.inserted;
+
+    free(workers);
+
+    return found;
+
+}
+
+// A connection to the server, with the responses received so far
+struct Client_t {
+
+    int file_descriptor;
+    char* input;
+    uint32_t input_length;
+    uint32_t input_consumed;
+    char* output;
+    uint32_t output_length;
+
+};
+
+typedef struct Client_t Client;
+
+// Requests a client builds before sending them with one write
+#define CLIENT_MAX_BATCH 1024
+#define CLIENT_REQUEST_SIZE 128
+
+void client_open(Client* client, const char* path) {
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    client->file_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (connect(client->file_descriptor, (struct sockaddr*)&address, 
+                sizeof(address)) == -1) {
+        printf("Unable to connect to '%s': %d\n", path, errno);
+        exit(EXIT_FAILURE);
+    }
+
+    client->input = malloc(SERVER_BUFFER_SIZE);
+    client->input_length = 0;
+    client->input_consumed = 0;
+    client->output = malloc(CLIENT_MAX_BATCH * CLIENT_REQUEST_SIZE);
+    client->output_length = 0;
+
+}
+
+void client_close(Client* client) {
+
+    close(client->file_descriptor);
+    free(client->input);
+    free(client->output);
+
+}
+
+void client_request(Client* client, const char* format, uint32_t id) {
+
+    char* request = client->output + client->output_length;
+    uint32_t length = snprintf(request + sizeof(uint32_t), 
+                               CLIENT_REQUEST_SIZE - sizeof(uint32_t),
+                               format, id, id, id);
+
+    memcpy(request, &length, sizeof(uint32_t));
+    client->output_length += sizeof(uint32_t) + length;
+
+}
+
+void client_send(Client* client) {
+
+    uint32_t written = 0;
+
+    while (written < client->output_length) {
+
+        ssize_t bytes_written = write(client->file_descriptor, 
+                                      client->output + written,
+                                      client->output_length - written);
+
+        if (bytes_written == -1) {
+            printf("Error sending requests: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        written += bytes_written;
+
+    }
+
+    client->output_length = 0;
+
+}
+
+/*
+    Function to take the next response received, without its length.
+    Blocks for more data only when `wait` is set, and returns false
+    if no complete response is buffered otherwise
+*/
+bool client_response(Client* client, bool wait, char** response, 
+                     uint32_t* length) {
+
+    while (true) {
+
+        uint32_t buffered = client->input_length - client->input_consumed;
+
+        if (buffered >= sizeof(uint32_t)) {
+
+            memcpy(length, client->input + client->input_consumed, sizeof(uint32_t));
+
+            if (buffered >= sizeof(uint32_t) + *length) {
+
+                *response = client->input + client->input_consumed + sizeof(uint32_t);
+                client->input_consumed += sizeof(uint32_t) + *length;
+                return true;
+
+            }
+
+        }
+
+        if (!wait) {
+            return false;
+        }
+
+        // Keep the partial response and make room for the rest of it
+        memmove(client->input, client->input + client->input_consumed, buffered);
+        client->input_length = buffered;
+        client->input_consumed = 0;
+
+        if (buffered >= sizeof(uint32_t) && 
+            sizeof(uint32_t) + *length > SERVER_BUFFER_SIZE) {
+            printf("Response too large.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        ssize_t bytes_read = read(client->file_descriptor, 
+                                  client->input + client->input_length,
+                                  SERVER_BUFFER_SIZE - client->input_length);
+
+        if (bytes_read <= 0) {
+            printf("Server closed the connection.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        client->input_length += bytes_read;
+
+    }
+
+}
+
+/*
+    Function to insert rows 1..rows through the server, 
+    CLIENT_MAX_BATCH requests at a time
+*/
+void server_load(const char* path, uint32_t rows) {
+
+    Client client;
+    client_open(&client, path);
+
+    for (uint32_t id = 1; id <= rows; ) {
+
+        uint32_t batch = 0;
+
+        while (batch < CLIENT_MAX_BATCH && id <= rows) {
+            client_request(&client, "insert %u user%u user%u@example.com", id++);
+            batch++;
+        }
+        client_send(&client);
+
+        char* response;
+        uint32_t length;
+        for (uint32_t i = 0; i < batch; i++) {
+            client_response(&client, true, &response, &length);
+        }
+
+    }
+
+    client_close(&client);
+
+}
+
+// A connection of the server-lookup workload
+struct ServerLookupThread_t {
+
+    pthread_t thread;
+    const char* path;
+    uint32_t rows;
+    uint32_t ops;
+    uint32_t pipeline;
+    uint64_t random_state;
+    uint64_t found;
+    Histogram* histogram;
+
+};
+
+typedef struct ServerLookupThread_t ServerLookupThread;
+
+/*
+    Keeps `pipeline` lookups in flight: whenever responses arrive, as
+    many new requests are sent with one write. Responses come back in
+    request order, so the send times are kept in a ring
+*/
+void* server_lookup_thread(void* argument) {
+
+    ServerLookupThread* worker = argument;
+    uint64_t* sent_at = malloc(worker->pipeline * sizeof(uint64_t));
+    uint32_t sent = 0, received = 0;
+    Client client;
+
+    client_open(&client, worker->path);
+
+    while (received < worker->ops) {
+
+        uint64_t send_time = now_ns();
+
+        while (sent < worker->ops && sent - received < worker->pipeline &&
+               client.output_length < (CLIENT_MAX_BATCH - 1) * CLIENT_REQUEST_SIZE) {
+
+            uint32_t id = xorshift_next(&worker->random_state) % worker->rows + 1;
+            client_request(&client, "select where id = %u", id);
+            sent_at[sent++ % worker->pipeline] = send_time;
+
+        }
+        client_send(&client);
+
+        char* response;
+        uint32_t length;
+        bool wait = true;
+
+        while (received < sent && client_response(&client, wait, &response, &length)) {
+
+            // Results, then a row whose uint16_t length is not zero
+            uint16_t row_length = 0;
+            if (response[0] == PREPARE_SUCCESS && response[1] == EXECUTE_SUCCESS &&
+                length >= 2 + sizeof(uint16_t)) {
+                memcpy(&row_length, response + 2, sizeof(uint16_t));
+            }
+
+            worker->found += row_length > 0;
+            histogram_record(worker->histogram, 
+                             now_ns() - sent_at[received++ % worker->pipeline]);
+            wait = false;
+
+        }
+
+    }
+
+    client_close(&client);
+    free(sent_at);
+
+    return NULL;
+
+}
+
+/*
+    Run the lookups of server-lookup over `num_threads` connections,
+    one thread each, merging their histograms into `histogram`. 
+    Returns the rows found.
+*/
+uint64_t run_server_lookups(const char* path, uint32_t rows, uint32_t ops,
+                            uint32_t num_threads, uint32_t pipeline,
+                            Histogram* histogram) {
+
+    ServerLookupThread* workers = calloc(num_threads, sizeof(ServerLookupThread));
+    uint64_t found = 0;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+
+        workers[i].path = path;
+        workers[i].rows = rows;
+        workers[i].ops = ops / num_threads + (i < ops % num_threads);
+        workers[i].pipeline = pipeline;
+        workers[i].random_state = next_random() | 1;
+        workers[i].histogram = calloc(1, sizeof(Histogram));
+        pthread_create(&workers[i].thread, NULL, server_lookup_thread, &workers[i]);
+
+    }
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+
+        pthread_join(workers[i].thread, NULL);
+        found += workers[i].found;
+
+        histogram_merge(histogram, workers[i].histogram);
+        free(workers[i].histogram);
+
+    }
+
+    free(workers);
+
+    return found;
+
+}
+
+void print_usage() {
+
+    printf("Usage: db_bench --workload <name> [options]\n"
+           "Workloads: seq-insert, random-insert, sql-insert, prepared-insert,\n"
+           "           uniform-lookup, zipf-lookup, full-scan, range-scan,\n"
+           "           filter-scan, concurrent-lookup, snapshot-scan, server-lookup\n"
+           "Options:\n"
+           "  --db <filename>        db file (default db_bench.db, replaced)\n"
+           "  --fresh                replace the --db file if it exists\n"
+           "  --rows <n>             rows inserted or preloaded (default 100000)\n"
+           "  --ops <n>              lookups or scans (default 100000)\n"
+           "  --range-length <n>     rows per range scan (default 100)\n"
+           "  --zipf-theta <theta>   skew of zipf-lookup (default 0.99)\n"
+           "  --threads <n>          lookup threads of concurrent-lookup, scan threads\n"
+           "                         of snapshot-scan, connections of server-lookup\n"
+           "                         (default 4)\n"
+           "  --socket <path>        socket of the server for server-lookup\n"
+           "  --pipeline <n>         requests in flight per connection (default 16)\n"
+           "  --scan-threads <n>     threads of a parallel scan (default one per CPU)\n"
+           "  --pool-pages <n>       buffer pool size in pages\n"
+           "  --mmap                 memory-mapped pager\n"
+           "  --cow                  copy-on-write mode, implied by snapshot-scan\n"
+           "  --no-wal               disable the write-ahead log\n"
+           "  --group-commit <n>     statements per log sync\n"
+           "  --io <backend>         uring, threads or sync (default uring)\n"
+           "  --seed <n>             random seed\n"
+           "  --format text|json     output format (default text)\n");
+
+}
+
+int main(int argc, char* argv[]) {
+
+    char* workload = NULL;
+    char* filename = "db_bench.db";
+    bool scratch_file = true;
+    bool fresh = false;
+    char* format = "text";
+    uint32_t rows = 100000;
+    uint32_t ops = 100000;
+    uint32_t range_length = 100;
+    double zipf_theta = 0.99;
+    uint32_t num_threads = 4;
+    char* socket_path = NULL;
+    uint32_t pipeline = 16;
+    DbOptions options = { .pager_mode = PAGER_BUFFER_POOL,
+                          .buffer_pool_pages = DEFAULT_BUFFER_POOL_PAGES,
+                          .wal = true,
+                          .wal_group_commit = DEFAULT_WAL_GROUP_COMMIT,
+                          .io_backend = IO_URING,
+                          .copy_on_write = false,
+                          .scan_threads = 0 };
+
+    for (int i = 1; i < argc; i++) {
+
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--workload") == 0 && has_value) {
+            workload = argv[++i];
+        }
+        else if (strcmp(argv[i], "--db") == 0 && has_value) {
+            filename = argv[++i];
+            scratch_file = false;
+        }
+        else if (strcmp(argv[i], "--fresh") == 0) {
+            fresh = true;
+        }
+        else if (strcmp(argv[i], "--rows") == 0 && has_value) {
+            rows = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--ops") == 0 && has_value) {
+            ops = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--range-length") == 0 && has_value) {
+            range_length = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--zipf-theta") == 0 && has_value) {
+            zipf_theta = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            num_threads = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--socket") == 0 && has_value) {
+            socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0 && has_value) {
+            pipeline = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--scan-threads") == 0 && has_value) {
+            options.scan_threads = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--pool-pages") == 0 && has_value) {
+            options.buffer_pool_pages = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--mmap") == 0) {
+            options.pager_mode = PAGER_MMAP;
+            options.wal = false;
+        }
+        else if (strcmp(argv[i], "--cow") == 0) {
+            options.copy_on_write = true;
+        }
+        else if (strcmp(argv[i], "--no-wal") == 0) {
+            options.wal = false;
+        }
+        else if (strcmp(argv[i], "--group-commit") == 0 && has_value) {
+            options.wal_group_commit = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--io") == 0 && has_value &&
+                 parse_io_backend(argv[i + 1], &options.io_backend)) {
+            i++;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            random_state = strtoull(argv[++i], NULL, 10) | 1;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && has_value) {
+            format = argv[++i];
+        }
+        else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    bool insert_workload = workload != NULL &&
+                           (strcmp(workload, "seq-insert") == 0 ||
+                            strcmp(workload, "random-insert") == 0 ||
+                            strcmp(workload, "sql-insert") == 0 ||
+                            strcmp(workload, "prepared-insert") == 0);
+    bool known_workload = insert_workload || (workload != NULL &&
+                          (strcmp(workload, "uniform-lookup") == 0 ||
+                           strcmp(workload, "zipf-lookup") == 0 ||
+                           strcmp(workload, "full-scan") == 0 ||
+                           strcmp(workload, "range-scan") == 0 ||
+                           strcmp(workload, "filter-scan") == 0 ||
+                           strcmp(workload, "concurrent-lookup") == 0 ||
+                           strcmp(workload, "snapshot-scan") == 0 ||
+                           strcmp(workload, "server-lookup") == 0));
+    bool server_workload = known_workload && 
+                           strcmp(workload, "server-lookup") == 0;
+
+    if (!known_workload || rows == 0 || num_threads == 0 || pipeline == 0 ||
+        (server_workload && socket_path == NULL)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    bool concurrent_workload = known_workload &&
+                               (strcmp(workload, "concurrent-lookup") == 0 ||
+                                strcmp(workload, "snapshot-scan") == 0);
+
+    // Snapshots only exist in copy-on-write mode
+    if (strcmp(workload, "snapshot-scan") == 0) {
+        options.copy_on_write = true;
+    }
+
+    /*
+        Start from a fresh db file, unless the server has the db. Only
+        the default scratch file is replaced without --fresh
+    */
+    Table* table = NULL;
+
+    if (!server_workload) {
+
+        char wal_filename[strlen(filename) + 5];
+        sprintf(wal_filename, "%s-wal", filename);
+
+        if (!scratch_file && !fresh &&
+            (access(filename, F_OK) == 0 || access(wal_filename, F_OK) == 0)) {
+            printf("'%s' exists, pass --fresh to replace it.\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        unlink(filename);
+        unlink(wal_filename);
+
+        table = db_open(filename, &options);
+
+    }
+
+    // Keys 1..rows, shuffled for random inserts
+    uint32_t* keys = malloc(rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < rows; i++) {
+        keys[i] = i + 1;
+    }
+
+    if (strcmp(workload, "random-insert") == 0) {
+
+        for (uint32_t i = rows - 1; i > 0; i--) {
+
+            uint32_t j = next_random() % (i + 1);
+            uint32_t key = keys[i];
+            keys[i] = keys[j];
+            keys[j] = key;
+
+        }
+
+    }
+
+    if (insert_workload) {
+        ops = rows;
+    }
+    else if (server_workload) {
+        server_load(socket_path, rows);
+    }
+    else {
+
+        for (uint32_t i = 0; i < rows; i++) {
+            insert_row(table, keys[i]);
+        }
+
+    }
+
+    Zipfian zipfian;
+    if (strcmp(workload, "zipf-lookup") == 0) {
+        zipfian_init(&zipfian, rows, zipf_theta);
+    }
+
+    InputBuffer* input_buffer = new_input_buffer();
+    input_buffer->buffer_length = 128;
+    input_buffer->buffer = malloc(input_buffer->buffer_length);
+
+    PrepareResult prepare_result;
+    PreparedStatement* insert = db_prepare("insert ? ? ?", &prepare_result);
+
+    Histogram* histogram = calloc(1, sizeof(Histogram));
+    Row row;
+    uint64_t rows_touched = 0;
+    uint64_t concurrent_inserts = 0;
+    uint64_t pages_read = table != NULL ? table->pager->pages_read : 0;
+    uint64_t pages_written = table != NULL ? table->pager->pages_written : 0;
+    uint64_t start = now_ns();
+
+    // The concurrent workload runs its ops on its own threads
+    uint32_t serial_ops = ops;
+
+    if (concurrent_workload) {
+
+        void* (*reader)(void*) = strcmp(workload, "snapshot-scan") == 0 ?
+                                 snapshot_thread : lookup_thread;
+
+        rows_touched = run_concurrent_reads(table, reader, rows, ops, 
+                                            range_length, num_threads,
+                                            histogram, &concurrent_inserts);
+        serial_ops = 0;
+
+    }
+    else if (server_workload) {
+
+        rows_touched = run_server_lookups(socket_path, rows, ops, num_threads,
+                                          pipeline, histogram);
+        serial_ops = 0;
+
+    }
+
+    for (uint32_t i = 0; i < serial_ops; i++) {
+
+        uint64_t op_start = now_ns();
+
+        if (insert_workload) {
+
+            ExecuteResult result;
+
+            if (strcmp(workload, "sql-insert") == 0) {
+                result = insert_sql(table, input_buffer, keys[i]);
+            }
+            else if (strcmp(workload, "prepared-insert") == 0) {
+                result = insert_prepared(table, insert, keys[i]);
+            }
+            else {
+                result = insert_row(table, keys[i]);
+            }
+
+            if (result != EXECUTE_SUCCESS) {
+                printf("Insert of %u failed.\n", keys[i]);
+                exit(EXIT_FAILURE);
+            }
+            rows_touched += 1;
+
+        }
+        else if (strcmp(workload, "uniform-lookup") == 0) {
+            rows_touched += lookup_row(table, next_random() % rows + 1, &row);
+        }
+        else if (strcmp(workload, "zipf-lookup") == 0) {
+            rows_touched += lookup_row(table, zipfian_next(&zipfian) + 1, &row);
+        }
+        else if (strcmp(workload, "full-scan") == 0) {
+            rows_touched += scan_rows(table, 0, UINT32_MAX);
+        }
+        else if (strcmp(workload, "filter-scan") == 0) {
+            filter_scan(table);
+            rows_touched += rows;
+        }
+        else {
+            rows_touched += scan_rows(table, next_random() % rows + 1,
+                                      range_length);
+        }
+
+        histogram_record(histogram, now_ns() - op_start);
+
+    }
+
+    // Inserts are only done once their pages are durable
+    if (insert_workload && table->pager->wal_enabled) {
+        wal_sync(table->pager);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    struct stat file_stat = { .st_size = 0 };
+
+    // The server's pages and file are not visible from here
+    if (table != NULL) {
+
+        pages_read = table->pager->pages_read - pages_read;
+        pages_written = table->pager->pages_written - pages_written;
+
+        db_close(table);
+        stat(filename, &file_stat);
+
+    }
+
+    double seconds = elapsed / 1e9;
+
+    if (strcmp(format, "json") == 0) {
+
+        printf("{\"workload\":\"%s\",\"rows\":%u,\"ops\":%u,"
+               "\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"rows_per_sec\":%.1f,"
+               "\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu,"
+               "\"pages_read\":%lu,\"pages_written\":%lu,\"file_bytes\":%ld,"
+               "\"concurrent_inserts\":%lu}\n",
+               workload, rows, ops, seconds, ops / seconds,
+               rows_touched / seconds,
+               histogram_percentile(histogram, 50),
+               histogram_percentile(histogram, 99),
+               histogram_percentile(histogram, 99.9),
+               histogram->max, pages_read, pages_written,
+               (long)file_stat.st_size, concurrent_inserts);
+
+    }
+    else {
+
+        printf("workload:      %s\n", workload);
+        printf("rows:          %u\n", rows);
+        printf("ops:           %u in %.3f s\n", ops, seconds);
+        printf("throughput:    %.1f ops/s, %.1f rows/s\n",
+               ops / seconds, rows_touched / seconds);
+        printf("latency (ns):  p50 %lu  p99 %lu  p999 %lu  max %lu\n",
+               histogram_percentile(histogram, 50),
+               histogram_percentile(histogram, 99),
+               histogram_percentile(histogram, 99.9),
+               histogram->max);
+        if (!server_workload) {
+
+            printf("pages:         %lu read, %lu written\n",
+                   pages_read, pages_written);
+            printf("file size:     %ld bytes\n", (long)file_stat.st_size);
+
+        }
+
+        if (concurrent_workload) {
+            printf("inserts:       %lu alongside the %s\n", concurrent_inserts,
+                   strcmp(workload, "snapshot-scan") == 0 ? "scans" : "lookups");
+        }
+
+    }
+
+    free(histogram);
+    free(keys);
+    db_prepared_close(insert);
+    close_input_buffer(input_buffer);
+
+    return 0;
+
+}
@@ -2,7 +2,34 @@
 
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
-#define TABLE_MAX_PAGES 100
+#define MAX_SELECT_COLUMNS 3
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_BUFFER_POOL_PAGES 1024
+#define INVALID_PAGE_NUM UINT32_MAX
+#define INVALID_FRAME UINT32_MAX
+#define MMAP_RESERVE_SIZE ((off_t)1 << 40)
+#define MMAP_MAX_GROWTH (64 * 1024 * 1024)
+#define DEFAULT_WAL_GROUP_COMMIT 32
+#define WAL_GROUP_COMMIT_WAIT_US 1000
+#define WAL_CHECKPOINT_RECORDS 4096
+#define WAL_MAGIC 0x57414c31
+#define DB_MAGIC 0x53444231
+#define INDEX_MAX_DEPTH 16
+#define INDEX_BUILD_COMMIT_ROWS 1024
+#define IO_QUEUE_DEPTH 64
+#define IO_WORKER_THREADS 4
+#define IO_MAX_RUN_PAGES 64
+#define READ_AHEAD_PAGES 16
+#define READ_AHEAD_TRIGGER 2
+#define TREE_MAX_DEPTH 16
+#define SNAPSHOT_MAX_READERS 64
+#define SCAN_RANGES_PER_THREAD 32
+#define SCAN_WINDOW_PER_THREAD 2
+#define SCAN_RANGE_BUFFER_SIZE (16 * 1024)
+#define SERVER_BUFFER_SIZE (64 * 1024)
+#define SERVER_MAX_REQUEST_SIZE (1024 * 1024)
+#define SERVER_MAX_EVENTS 64
+#define BATCH_BUFFER_SIZE (1024 * 1024)
 
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
 
@@ -30,32 +57,364 @@ struct Row_t {
 
 typedef struct Row_t Row;
 
+// A `?` in a statement and the field its value is bound to
+struct Parameter_t {
+
+    ParameterTarget target;
+    uint32_t position;          // Row of an insert or id of a list
+    bool bound;
+
+};
+
+typedef struct Parameter_t Parameter;
+
 struct Statement_t {
   
     StatementType type;
     Row row_to_insert;
 
+    // Rows of an insert, pointing at row_to_insert for a single row
+    Row* rows_to_insert;
+    uint32_t num_rows;
+
+    // Columns printed by a select, in order; 0 selects the whole row
+    Column columns[MAX_SELECT_COLUMNS];
+    uint32_t num_columns;
+
+    // Aggregates a select prints instead of rows, in order
+    Aggregate aggregates[MAX_SELECT_COLUMNS];
+    uint32_t num_aggregates;
+
+    // Filter on the primary key or on a string column for select statements
+    WhereType where_type;
+    uint32_t where_low;
+    uint32_t where_high;
+    Column where_column;
+    char where_value[COLUMN_EMAIL_SIZE + 1];
+
+    // Ids of a point lookup, sorted and without duplicates
+    uint32_t* where_ids;
+    uint32_t num_where_ids;
+
+    // Column of a create index statement
+    Column index_column;
+
+    // `?` parameters of a prepared statement, in order
+    Parameter* parameters;
+    uint32_t num_parameters;
+
 };
 
 typedef struct Statement_t Statement;
 
+// A statement compiled once, to be bound and executed many times
+struct PreparedStatement_t {
+
+    Statement statement;
+
+    // Copies of the rows and ids that executing sorts, if any
+    Row* rows;
+    uint32_t* ids;
+
+};
+
+typedef struct PreparedStatement_t PreparedStatement;
+
+// A token of a statement, pointing into its text
+struct Token_t {
+
+    TokenType type;
+    const char* start;
+    uint32_t length;
+
+};
+
+typedef struct Token_t Token;
+
+// State of the compiler while it reads the tokens of a statement
+struct Parser_t {
+
+    const char* position;       // Text after the current token
+    const char* end;
+    Token token;
+    Statement* statement;
+
+    uint32_t rows_capacity;
+    uint32_t ids_capacity;
+    uint32_t parameters_capacity;
+
+};
+
+typedef struct Parser_t Parser;
+
+// Options to configure a database when it is opened
+struct DbOptions_t {
+
+    PagerMode pager_mode;
+    uint32_t buffer_pool_pages;
+
+    // Write-ahead log, only available with the buffer pool
+    bool wal;
+    uint32_t wal_group_commit;  // Statements per fdatasync of the log
+
+    // Asynchronous page I/O, only available with the buffer pool
+    IoBackend io_backend;
+
+    /*
+        Copy-on-write tree with snapshots. It runs on the memory-mapped
+        pager without the log, whatever the other options say, and a
+        file once written in this mode is always opened in it
+    */
+    bool copy_on_write;
+
+    // Threads of a parallel table scan, 0 for one per CPU
+    uint32_t scan_threads;
+
+};
+
+typedef struct DbOptions_t DbOptions;
+
+// A frame of the buffer pool which caches one page of the file
+struct Frame_t {
+
+    uint32_t page_num;      // INVALID_PAGE_NUM while the frame is unused
+    uint32_t pin_count;     // Pinned frames are never evicted
+    uint32_t hash_next;     // Next frame in the same page table bucket
+    bool dirty;
+    bool referenced;        // Reference bit for CLOCK eviction
+    bool wal_pending;       // Modified by the statement being executed
+    bool statement_pinned;  // Pinned once by get_page() this statement
+    bool io_pending;        // An asynchronous read or write is in flight
+    bool loading;           // Read by a thread outside of pool_lock
+    pthread_rwlock_t* latch;    // Guards the page between threads
+    void* data;
+
+};
+
+typedef struct Frame_t Frame;
+
+// A page read or write handed to the asynchronous I/O backend
+struct IoRequest_t {
+
+    bool in_use;
+    bool write;
+    bool done;              // Set by a worker thread when it finishes
+
+    // Frames of a run of adjacent pages, in page order; reads are one page
+    uint32_t frame_indices[IO_MAX_RUN_PAGES];
+    struct iovec iov[IO_MAX_RUN_PAGES];
+    uint32_t num_pages;
+
+    off_t offset;
+    ssize_t result;
+
+};
+
+typedef struct IoRequest_t IoRequest;
+
+/*
+    Asynchronous page I/O. Requests go to an io_uring when the kernel
+    provides one, otherwise to a small pool of threads doing pread
+    and pwrite. Only the thread which owns the pager touches frames;
+    completions are applied to them when they are reaped.
+*/
+struct AsyncIo_t {
+
+    IoBackend backend;
+    int file_descriptor;
+    IoRequest requests[IO_QUEUE_DEPTH];
+    uint32_t in_flight;
+
+    // io_uring submission and completion rings, shared with the kernel
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    uint32_t unsubmitted;
+
+    // Thread pool fallback
+    pthread_t workers[IO_WORKER_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    uint32_t queue[IO_QUEUE_DEPTH];
+    uint32_t queue_head;
+    uint32_t queue_length;
+    bool shutdown;
+
+};
+
+typedef struct AsyncIo_t AsyncIo;
+
 // A Pager structure to access the page caches and files
 struct Pager_t {
 
+    PagerMode mode;
     int file_descriptor;
-    uint32_t file_length;
+    off_t file_length;
     uint32_t num_pages;
-    void* pages[TABLE_MAX_PAGES];
+
+    // Memory-mapped mode: the file is mapped over a reserved range
+    void* map;
+
+    /*
+        Buffer pool. Pages are found through a chained hash table
+        from page number to frame index, and evicted with CLOCK
+        once pool_size frames are in use. Frames added past pool_size
+        while every frame is pinned are freed when the statement ends.
+    */
+    Frame* frames;
+    uint32_t num_frames;
+    uint32_t frames_capacity;
+    uint32_t pool_size;
+    uint32_t* page_table;
+    uint32_t page_table_mask;
+    uint32_t clock_hand;
+
+    // Frames pinned by get_page(), each once, until they are released
+    uint32_t* statement_pins;
+    uint32_t num_statement_pins;
+    uint32_t statement_pins_capacity;
+
+    /*
+        Write-ahead log. Pages modified by a statement are appended
+        to an in-memory log buffer when it finishes, and the buffer
+        is written and synced once per group of statements.
+    */
+    bool wal_enabled;
+    int wal_file_descriptor;
+    void* wal_buffer;
+    uint32_t wal_buffer_length;
+    uint32_t wal_buffer_capacity;
+    uint32_t wal_group_commit;
+    uint32_t wal_records;
+    uint32_t* wal_pending;
+    uint32_t num_wal_pending;
+    uint32_t wal_pending_capacity;
+    uint32_t* wal_logging;      // The pending list taken by a commit
+    uint32_t wal_logging_capacity;
+
+    // Threads in db_insert() wait for the sync of their group
+    uint64_t wal_logged;        // Statements appended to the log
+    uint64_t wal_durable;       // Of those, synced
+    uint32_t wal_writers;       // Threads in db_insert()
+    uint32_t wal_waiters;       // Of those, waiting for a sync
+    bool wal_syncing;           // One of them is syncing the log
+    pthread_cond_t wal_synced;
+
+    // Page I/O counters of the buffer pool
+    uint64_t pages_read;
+    uint64_t pages_written;
+
+    AsyncIo io;
+
+    /*
+        Between threads, pool_lock guards the frames and the page
+        table, and wal_lock the log. A thread holding a page latch
+        may take pool_lock, and one holding wal_lock may take either,
+        but no thread waits for a latch or the log under pool_lock.
+        A thread holding read latches also takes wal_lock to evict a
+        dirty frame; the log is only read under read latches, which
+        do not wait for other readers. Threads missing a page which
+        another thread is reading in wait for frame_loaded.
+    */
+    pthread_mutex_t pool_lock;
+    pthread_mutex_t wal_lock;
+    pthread_cond_t frame_loaded;
 
 };
 
 typedef struct Pager_t Pager;
 
+// A page pinned and latched by one thread
+struct PageHandle_t {
+
+    uint32_t frame_index;       // INVALID_FRAME in the memory-mapped mode
+    pthread_rwlock_t* latch;
+    LatchMode mode;
+    void* data;
+
+};
+
+typedef struct PageHandle_t PageHandle;
+
+// Output buffer the rows of a select are formatted into
+struct ResultSink_t {
+
+    OutputFormat format;
+    int file_descriptor;        // -1 to keep the whole result in the buffer
+    char* buffer;
+    uint32_t length;
+    uint32_t capacity;
+
+};
+
+typedef struct ResultSink_t ResultSink;
+
+// A page replaced by copy-on-write, freed once no snapshot reads it
+struct RetiredPage_t {
+
+    uint32_t page_num;
+    uint32_t epoch;         // Last epoch whose tree contains the page
+
+};
+
+typedef struct RetiredPage_t RetiredPage;
+
+// State of the table tree in copy-on-write mode
+struct CopyOnWrite_t {
+
+    bool enabled;
+    uint32_t epoch;         // Epoch of the published tree
+    bool changed;           // Modified since it was published
+
+    /*
+        Epoch in which each page was last written. Pages written in
+        epoch + 1 are not published yet, so they are changed in place
+    */
+    uint32_t* page_epochs;
+    uint32_t page_epochs_capacity;
+
+    RetiredPage* retired;
+    uint32_t num_retired;
+    uint32_t retired_capacity;
+
+    // Epoch each open snapshot reads, 0 for a free slot
+    uint32_t readers[SNAPSHOT_MAX_READERS];
+
+};
+
+typedef struct CopyOnWrite_t CopyOnWrite;
+
 // Structure to keep track of the pages of the rows
 struct Table_t {
 
     uint32_t root_page_num;
     Pager* pager;
+    ResultSink sink;
+
+    /*
+        Held shared by cursors and inserts which stay within one
+        leaf, and exclusively by statements, which may split, merge
+        or rebalance nodes and so change the shape of the trees.
+        Threads pass the turnstile to take it, which a thread waiting
+        to take it exclusively holds, so readers cannot starve it.
+    */
+    pthread_rwlock_t tree_latch;
+    pthread_mutex_t tree_turnstile;
+
+    CopyOnWrite cow;
+    uint32_t scan_threads;
 };
 
 typedef struct Table_t Table;
@@ -67,11 +426,174 @@ struct Cursor_t {
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;
+    uint32_t leaves_followed;   // Leaves reached by the sibling pointers
+
+    // Cursors of other threads keep their leaf latched
+    bool latched;
+    PageHandle leaf;
+
+    /*
+        Internal nodes passed on the way to the leaf, and the child
+        taken in each. A copy-on-write tree has no sibling pointers,
+        so cursors step to the next leaf along this path.
+    */
+    uint32_t depth;
+    uint32_t path_pages[TREE_MAX_DEPTH];
+    uint32_t path_children[TREE_MAX_DEPTH];
+    bool snapshot;              // Reads the map directly, without latches
 
 };
 
 typedef struct Cursor_t Cursor;
 
+// A published version of the table tree, read without latches
+struct Snapshot_t {
+
+    Table* table;
+    uint32_t root_page_num;
+    uint32_t epoch;
+    uint32_t slot;              // Reader slot pinning the epoch
+
+};
+
+typedef struct Snapshot_t Snapshot;
+
+// Running values of the aggregates of a select
+struct Aggregates_t {
+
+    uint32_t count;
+    uint32_t min_id;
+    uint32_t max_id;
+
+};
+
+typedef struct Aggregates_t Aggregates;
+
+// A range of keys scanned by one task of a parallel scan
+struct ScanRange_t {
+
+    uint32_t low;
+    uint32_t high;
+    ResultSink sink;            // Rows of the range, written out in order
+    Aggregates aggregates;      // Or its partial aggregates
+    bool done;
+
+};
+
+typedef struct ScanRange_t ScanRange;
+
+struct ParallelScan_t;
+
+// A thread of a parallel scan with the ranges it has left
+struct ScanWorker_t {
+
+    struct ParallelScan_t* scan;
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    // Ranges worker_num + k * num_workers for head <= k < tail
+    uint32_t head;
+    uint32_t tail;
+
+};
+
+typedef struct ScanWorker_t ScanWorker;
+
+// A select scanning key ranges of the table on several threads
+struct ParallelScan_t {
+
+    Table* table;
+    Statement* statement;
+    const Column* columns;
+    uint32_t num_columns;
+    Aggregates* aggregates;     // NULL for a select of rows
+
+    ScanRange* ranges;
+    uint32_t num_ranges;
+    ScanWorker* workers;
+    uint32_t num_workers;
+
+    /*
+        Only ranges below written + window are scanned, so however
+        far the threads get ahead of the calling thread, the rows
+        formatted but not yet written out stay bounded
+    */
+    uint32_t window;
+    uint32_t written;
+
+    // Signalled whenever a range is done, or written out
+    pthread_mutex_t lock;
+    pthread_cond_t range_done;
+    pthread_cond_t range_written;
+
+};
+
+typedef struct ParallelScan_t ParallelScan;
+
+// A cell of an index node while the node is being rewritten
+struct IndexCell_t {
+
+    uint32_t key;       // Row id in a leaf, child page in an internal node
+    void* entry;
+    uint32_t length;
+
+};
+
+typedef struct IndexCell_t IndexCell;
+
+// A client of the server
+struct Connection_t {
+
+    int file_descriptor;
+    uint32_t index;             // Position in the server's connections
+
+    // Received bytes, which may end in a partial request
+    char* input;
+    uint32_t input_length;
+    uint32_t input_capacity;
+
+    // Responses to send, from `output_sent` on
+    ResultSink output;
+    uint32_t output_sent;
+    bool unsynced;              // Responses wait for the log to be synced
+
+};
+
+typedef struct Connection_t Connection;
+
+struct Server_t {
+
+    Table* table;
+    int listen_file_descriptor;
+    int epoll_file_descriptor;
+    InputBuffer* input_buffer;  // Statement text of the current request
+
+    Connection** connections;
+    uint32_t num_connections;
+    uint32_t connections_capacity;
+
+    // Connections with responses to send once the log is synced
+    Connection** unsynced;
+    uint32_t num_unsynced;
+
+};
+
+typedef struct Server_t Server;
+
+// State of a script run in batch mode
+struct Batch_t {
+
+    Table* table;
+    InputBuffer* input_buffer;  // Copy of a meta command
+    uint32_t line_number;
+    uint64_t statements;
+    uint64_t failed;
+    bool stopped;               // `.exit` was read
+
+};
+
+typedef struct Batch_t Batch;
+
 // A small wrapper to interract with getline()
 InputBuffer* new_input_buffer() {
     
@@ -86,15 +608,19 @@ InputBuffer* new_input_buffer() {
 }
 
 /*
-    Compact representation of a Row in the table
+    Compact representation of a Row in the table. Strings are
+    stored as a one byte length followed by their characters,
+    without padding, so a serialized row is variable length
 */
 const uint32_t ID_SIZE = size_of_attribute(Row, id);
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
 const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+const uint32_t STRING_LENGTH_SIZE = sizeof(uint8_t);
 const uint32_t ID_OFFSET = 0;
 const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t ROW_MIN_SIZE = ID_SIZE + 2 * STRING_LENGTH_SIZE;
+const uint32_t ROW_MAX_SIZE = 
+                ROW_MIN_SIZE + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE;
 
 /* 
     Keeping track of the number of rows
@@ -118,26 +644,41 @@ const uint8_t COMMON_NODE_HEADER_SIZE =
 */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = 
-                COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = 
+                LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = 
+                LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + 
+                                       LEAF_NODE_NUM_CELLS_SIZE +
+                                       LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_CONTENT_START_SIZE;
 
 /*
-    Leaf Node Body Layout
+    Leaf Node Body Layout. A slotted page: a slot array sorted by
+    key grows from the header, and the row payloads it points at
+    are packed from the end of the page. Each slot carries its key
+    next to the 2-byte payload offset so that a search only reads
+    the slot array, and an insert only moves slots.
 */
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = 
+const uint32_t LEAF_NODE_CELL_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CELL_OFFSET_OFFSET = 
                 LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = 
-                LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_CELL_LENGTH_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CELL_LENGTH_OFFSET = 
+                LEAF_NODE_CELL_OFFSET_OFFSET + LEAF_NODE_CELL_OFFSET_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + 
+                                     LEAF_NODE_CELL_OFFSET_SIZE +
+                                     LEAF_NODE_CELL_LENGTH_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = 
                 PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_MAX_CELLS = 
-                LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = 
-                (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_LEFT_SPLIT_COUNT;
+                LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + ROW_MIN_SIZE);
+// A leaf using fewer bytes after a delete is merged with a sibling or borrows from it
+const uint32_t LEAF_NODE_MIN_FILL = LEAF_NODE_SPACE_FOR_CELLS / 3;
 
 /*
     Internal Node Header Layout
@@ -147,17 +688,74 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = 
                 INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                           INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+// Padded to 16 bytes, so every key of the body is aligned
+const uint32_t INTERNAL_NODE_HEADER_SIZE = (COMMON_NODE_HEADER_SIZE +
+                                            INTERNAL_NODE_NUM_KEYS_SIZE +
+                                            INTERNAL_NODE_RIGHT_CHILD_SIZE + 15) & ~15;
 
 /* 
-    Internal Node Body Layout
+    Internal Node Body Layout. The keys and the child pointers are
+    two separate arrays, each sized for INTERNAL_NODE_MAX_CELLS,
+    so a search only reads the contiguous key array
 */
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE = 
                 INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = 
+                PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_MAX_CELLS = 
+                INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+const uint32_t INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_CELLS / 3;
+const uint32_t INTERNAL_NODE_KEYS_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_CHILDREN_OFFSET = 
+                INTERNAL_NODE_KEYS_OFFSET + 
+                INTERNAL_NODE_MAX_CELLS * INTERNAL_NODE_KEY_SIZE;
+
+/*
+    Database Header Page Layout. Page 0 describes the file: the
+    page of the table root, the root of the secondary index on
+    each column (INVALID_PAGE_NUM when there is none), the
+    first page of the free list and the file flags. In copy-on-write
+    mode the published tree is also kept as one aligned 64-bit
+    word, the epoch in the high and the root page in the low half,
+    so that snapshots read both with a single load
+*/
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+const uint32_t DB_HEADER_MAGIC_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_ROOT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = 
+                DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE;
+const uint32_t DB_HEADER_INDEX_ROOT_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_INDEX_ROOTS_OFFSET = 
+                DB_HEADER_ROOT_PAGE_OFFSET + DB_HEADER_ROOT_PAGE_SIZE;
+const uint32_t DB_HEADER_INDEX_ROOTS_SIZE = 
+                (COLUMN_EMAIL + 1) * DB_HEADER_INDEX_ROOT_SIZE;
+const uint32_t DB_HEADER_FREE_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_FREE_PAGE_OFFSET = 
+                DB_HEADER_INDEX_ROOTS_OFFSET + DB_HEADER_INDEX_ROOTS_SIZE;
+const uint32_t DB_HEADER_FLAGS_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_FLAGS_OFFSET = 
+                DB_HEADER_FREE_PAGE_OFFSET + DB_HEADER_FREE_PAGE_SIZE;
+const uint32_t DB_HEADER_SNAPSHOT_SIZE = sizeof(uint64_t);
+const uint32_t DB_HEADER_SNAPSHOT_OFFSET = 
+                (DB_HEADER_FLAGS_OFFSET + DB_HEADER_FLAGS_SIZE + 7) & ~7;
+const uint32_t DB_FLAG_COPY_ON_WRITE = 1 << 0;
+
+/*
+    Free Page Layout. Freed pages are chained through the header
+    page; the header is never free, so page 0 ends the list
+*/
+const uint32_t FREE_PAGE_NEXT_SIZE = sizeof(uint32_t);
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+
+/*
+    Index Node Layout. Index nodes are slotted pages like leaves,
+    and a cell's payload is an index entry: the row id followed by
+    the characters of the column value
+*/
+const uint32_t INDEX_ENTRY_MAX_SIZE = ID_SIZE + COLUMN_EMAIL_SIZE;
 
 /* 
     Function to get the NODE type
@@ -193,6 +791,10 @@ void set_node_root(void* node, bool is_root) {
 
 }
 
+uint32_t* node_parent(void* node) {
+    return node + PARENT_POINTER_OFFSET;
+}
+
 /*
     Methods for reading and writing into Internal Nodes
 */
@@ -204,8 +806,12 @@ uint32_t* internal_node_right_child(void* node) {
     return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
-uint32_t internal_node_cell(void* node, uint32_t cell_num) {
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+/*
+    Child pointer of cell `cell_num`, without the right child
+    handling of internal_node_child()
+*/
+uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_CHILDREN_OFFSET + cell_num * INTERNAL_NODE_CHILD_SIZE;
 }
 
 uint32_t* internal_node_child(void* node, uint32_t child_num) {
@@ -226,7 +832,7 @@ uint32_t* internal_node_child(void* node, uint32_t child_num) {
 }
 
 uint32_t* internal_node_key(void* node, uint32_t key_num) {
-    return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+    return node + INTERNAL_NODE_KEYS_OFFSET + key_num * INTERNAL_NODE_KEY_SIZE;
 }
 
 void initialize_internal_node(void* node) {
@@ -234,6 +840,7 @@ void initialize_internal_node(void* node) {
     set_node_type(node, NODE_INTERNAL);
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
 
 }
 
@@ -244,744 +851,8468 @@ uint32_t* leaf_node_num_cells(void* node) {
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+uint32_t* leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+uint16_t* leaf_node_content_start(void* node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+void* leaf_node_slot(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
 }
 
 uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num);
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_KEY_OFFSET;
+}
+
+uint16_t* leaf_node_cell_offset(void* node, uint32_t cell_num) {
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_CELL_OFFSET_OFFSET;
+}
+
+uint16_t* leaf_node_cell_length(void* node, uint32_t cell_num) {
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_CELL_LENGTH_OFFSET;
 }
 
 void* leaf_node_value(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+    return node + *leaf_node_cell_offset(node, cell_num);
 }
 
 void initialize_leaf_node(void* node) {
     set_node_type(node, NODE_LEAF);
     set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = INVALID_PAGE_NUM;  // No sibling
+    *leaf_node_content_start(node) = PAGE_SIZE;
 }
 
 /*
-    Function to get the maximum node key value in LEAF as well
-    INTERNAL nodes
+    Bytes between the end of the slot array and the first payload
+*/
+uint32_t leaf_node_free_space(void* node) {
+    return *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE -
+           *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+}
+
+/*
+    Bytes taken by the slots and the payloads they point at
 */
-void* get_max_node_key(void* node) {
+uint32_t leaf_node_used_space(void* node) {
 
-    switch(get_node_type(node)) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t used = num_cells * LEAF_NODE_SLOT_SIZE;
 
-        case NODE_INTERNAL:
-            return internal_node_key(node, *internal_node_num_keys(node) -1);
-        case NODE_LEAF:
-            return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        used += *leaf_node_cell_length(node, i);
+    }
+
+    return used;
+
+}
+
+/*
+    Function to check whether a row of `length` bytes fits in the
+    leaf, counting space left behind by payloads which no longer
+    have a slot as well as the contiguous free space
+*/
+bool leaf_node_has_room(void* node, uint32_t length) {
 
+    uint32_t needed = length + LEAF_NODE_SLOT_SIZE;
+
+    if (leaf_node_free_space(node) >= needed) {
+        return true;
     }
 
+    return LEAF_NODE_SPACE_FOR_CELLS - leaf_node_used_space(node) >= needed;
+
 }
 
 /*
-    Function to serialize the row data 
+    Function to pack the payloads of a leaf against the end of the
+    page again, in slot order, so all free space is contiguous
 */
-void serialize_row(Row* source, void* destination) {
+void leaf_node_compact(void* node) {
 
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+    uint8_t scratch[PAGE_SIZE];
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t content_start = PAGE_SIZE;
+
+    memcpy(scratch, node, PAGE_SIZE);
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+
+        uint32_t length = *leaf_node_cell_length(node, i);
+
+        content_start -= length;
+        memcpy(node + content_start, leaf_node_value(scratch, i), length);
+        *leaf_node_cell_offset(node, i) = content_start;
+
+    }
+
+    *leaf_node_content_start(node) = content_start;
 
 }
 
 /*
-    Function to deserialize the row data from memory
+    Function to add a cell after the last slot of a leaf. The
+    caller makes sure the key is the largest and that it fits
 */
-void deserialize_row(void* source, Row* destination) {
+void leaf_node_append_cell(void* node, uint32_t key, 
+                           void* payload, uint32_t length) {
 
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);    
+    uint32_t cell_num = *leaf_node_num_cells(node);
+    uint32_t content_start = *leaf_node_content_start(node) - length;
+
+    memcpy(node + content_start, payload, length);
+    *leaf_node_content_start(node) = content_start;
+
+    *leaf_node_key(node, cell_num) = key;
+    *leaf_node_cell_offset(node, cell_num) = content_start;
+    *leaf_node_cell_length(node, cell_num) = length;
+    *leaf_node_num_cells(node) += 1;
 
 }
 
 /*
-    Function to print a row of the table
+    Function to remove the cell at `cell_num`. Its payload is left
+    behind as a hole, reclaimed by the next compaction
 */
-void print_row(Row* row) {
-    printf("( %d, %s, %s )\n", row->id, row->username, row->email);
-} 
+void leaf_node_remove_cell(void* node, uint32_t cell_num) {
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    memmove(leaf_node_slot(node, cell_num),
+            leaf_node_slot(node, cell_num + 1),
+            (num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+
+    *leaf_node_num_cells(node) = num_cells - 1;
+
+}
 
 /*
-Get a page and handle a cache miss
+    Function to insert a cell at `cell_num`, shifting only the slots
+    after it. The caller checks leaf_node_has_room() first
 */
-void* get_page(Pager* pager, uint32_t page_num) {
+void leaf_node_insert_cell(void* node, uint32_t cell_num, uint32_t key,
+                           void* payload, uint32_t length) {
 
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
 
-    if (pager->pages[page_num] == NULL) {
-        // A cache miss. Allocate memory and load from file.
-        void *page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
- 
-        // We might save a partial page at the end of the file
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
+    if (leaf_node_free_space(node) < length + LEAF_NODE_SLOT_SIZE) {
+        leaf_node_compact(node);
+    }
 
-        if (page_num <= num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-        
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
+    if (cell_num < num_cells) {
 
-        pager->pages[page_num] = page;
+        // Make room for new slot
+        memmove(leaf_node_slot(node, cell_num + 1),
+                leaf_node_slot(node, cell_num),
+                (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
 
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
-    
     }
 
-    return pager->pages[page_num];
+    uint32_t content_start = *leaf_node_content_start(node) - length;
 
-}
+    memcpy(node + content_start, payload, length);
+    *leaf_node_content_start(node) = content_start;
+
+    *(leaf_node_num_cells(node)) += 1;
+    *(leaf_node_key(node, cell_num)) = key;
+    *(leaf_node_cell_offset(node, cell_num)) = content_start;
+    *(leaf_node_cell_length(node, cell_num)) = length;
 
-/* 
-    Function to allocate a new page to the nodes. Now,
-    allocates the new page at the end of database file.
-    After implementing deletion, we can re-allocate 
-    unused pages.
-*/
-uint32_t get_unused_page_num(Pager* pager) {
-    return pager->num_pages;
 }
 
 /*
-    Function to allocate new page to store the left child
+    Accessing the Database Header Page
 */
-void create_new_root(Table* table, uint32_t right_child_page_num) {
+uint32_t* db_header_magic(void* header) {
+    return header + DB_HEADER_MAGIC_OFFSET;
+}
 
-    /*
-        Handle splitting the root.
-        Copying the old root to the left child (to new page).
-        Address of right child passed in.
-        Re-initialize root page to contain the new root node.
-        New root node points to the two childs.
-    */
+uint32_t* db_header_root_page(void* header) {
+    return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
 
-    void* root = get_page(table->pager, table->root_page_num);
-    void* right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void* left_child = get_page(table->pager, left_child_page_num);
+uint32_t* db_header_index_root(void* header, Column column) {
+    return header + DB_HEADER_INDEX_ROOTS_OFFSET + 
+           column * DB_HEADER_INDEX_ROOT_SIZE;
+}
 
-    // Left child has data copied from the old root
-    memcpy(left_child, root, PAGE_SIZE);
-    set_node_root(left_child, false);
+uint32_t* db_header_free_page(void* header) {
+    return header + DB_HEADER_FREE_PAGE_OFFSET;
+}
 
-    // Set the root as new internal node with two children
-    initialize_internal_node(root);
-    set_node_root(root, true);
-    *internal_node_num_keys(root) = 1;
-    *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_max_node_key(left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
- 
+uint32_t* db_header_flags(void* header) {
+    return header + DB_HEADER_FLAGS_OFFSET;
+}
+
+uint64_t* db_header_snapshot(void* header) {
+    return header + DB_HEADER_SNAPSHOT_OFFSET;
+}
+
+uint32_t* free_page_next(void* page) {
+    return page + FREE_PAGE_NEXT_OFFSET;
 }
 
 /*
-    Function for inserying a key-value pair into a leaf node
-    in case of a full node
+    Accessing Index Nodes. The right child of an internal index
+    node is kept where a leaf keeps its sibling
 */
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+uint32_t* index_node_right_child(void* node) {
+    return leaf_node_next_leaf(node);
+}
 
-    /*
-        Create a new node and move half the cells over. Insert the 
-        new value in one of the two nodes. Update the parent or
-        create a new parent.
-    */
+uint32_t index_node_child(void* node, uint32_t child_num) {
 
-   void* old_node = get_page(cursor->table->pager, cursor->page_num);
-   uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-   void* new_node = get_page(cursor->table->pager, new_page_num);
-   initialize_leaf_node(new_node);
+    if (child_num == *leaf_node_num_cells(node)) {
+        return *index_node_right_child(node);
+    }
 
-    /*
-        All existing keys plus new key should be divided evenly between
-        old (left) and new (right) nodes. Starting from right, move each
-        key to correct position.
-    */
+    return *leaf_node_key(node, child_num);
 
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        
-        void* destination_node;
+}
 
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        }
-        else {
-            destination_node = old_node;
-        }
+void initialize_index_node(void* node, NodeType type) {
+    initialize_leaf_node(node);
+    set_node_type(node, type);
+}
 
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, index_within_node);
+/*
+    Branch-free lower bound over the keys of a node. Keys are read
+    every `stride` bytes starting at `first_key`. Returns the index
+    of the first key >= `key`, or `num_keys` if there is none.
+    The comparison compiles to a conditional move, so the loop runs
+    a fixed log2(num_keys) steps without mispredicted branches.
+*/
+uint32_t node_key_lower_bound(void* first_key, uint32_t stride,
+                              uint32_t num_keys, uint32_t key) {
 
-        if (i == cursor->cell_num) {
-            serialize_row(value, destination);
-        }
-        else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
-        else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
-        }
-    
+    if (num_keys == 0) {
+        return 0;
     }
 
-    /*
-        Update cell count on both the leaf nodes
-    */
+    uint32_t base = 0;
+    uint32_t length = num_keys;
 
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    while (length > 1) {
 
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
-    }   
-    else {
+        uint32_t half = length / 2;
+        uint32_t probe = *(uint32_t*)(first_key + (base + half) * stride);
 
-        printf("Need to implement updating parent after split.\n");
-        exit(EXIT_FAILURE);
+        base = (probe < key) ? base + half : base;
+        length -= half;
 
     }
 
+    return base + (*(uint32_t*)(first_key + base * stride) < key);
+
 }
 
 /*
-    Function for inserting a key-value pair into a leaf node
+    Function to find the index of the child which should contain
+    the given key. Key i is the maximum key of child i, so the
+    child is the first one whose key is >= the given key; keys
+    larger than every separator go to the right child
 */
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
+uint32_t internal_node_find_child(void* node, uint32_t key) {
 
-    void* node = get_page(cursor->table->pager,cursor->page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
 
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    return node_key_lower_bound(internal_node_key(node, 0),
+                                INTERNAL_NODE_KEY_SIZE, num_keys, key);
 
-        // Node is full
-        leaf_node_split_and_insert(cursor, key, value);
-        return;
+}
+
+/*
+    Function to serialize the row data. Returns the number of 
+    bytes written, at most ROW_MAX_SIZE
+*/
+uint32_t serialize_row(Row* source, void* destination) {
+
+    uint8_t username_length = strlen(source->username);
+    uint8_t email_length = strlen(source->email);
+    void* field = destination + USERNAME_OFFSET;
+
+    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
+
+    *(uint8_t*)field = username_length;
+    memcpy(field + STRING_LENGTH_SIZE, source->username, username_length);
+    field += STRING_LENGTH_SIZE + username_length;
+
+    *(uint8_t*)field = email_length;
+    memcpy(field + STRING_LENGTH_SIZE, source->email, email_length);
+    field += STRING_LENGTH_SIZE + email_length;
+
+    return field - destination;
+
+}
+
+/*
+    Number of bytes serialize_row() writes for a row
+*/
+uint32_t serialized_row_size(Row* row) {
+    return ROW_MIN_SIZE + strlen(row->username) + strlen(row->email);
+}
+
+/*
+    Function to deserialize the row data from memory
+*/
+void deserialize_row(void* source, Row* destination) {
+
+    void* field = source + USERNAME_OFFSET;
+
+    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
+
+    uint8_t username_length = *(uint8_t*)field;
+    memcpy(destination->username, field + STRING_LENGTH_SIZE, username_length);
+    destination->username[username_length] = '\0';
+    field += STRING_LENGTH_SIZE + username_length;
+
+    uint8_t email_length = *(uint8_t*)field;
+    memcpy(destination->email, field + STRING_LENGTH_SIZE, email_length);
+    destination->email[email_length] = '\0';
+
+}
+
+/*
+    Functions to read the string columns of a serialized row in 
+    place, without copying it into a Row. They return a pointer 
+    to the characters, which are not null terminated
+*/
+char* row_username(void* source, uint8_t* length) {
+
+    void* field = source + USERNAME_OFFSET;
+
+    *length = *(uint8_t*)field;
+    return field + STRING_LENGTH_SIZE;
+
+}
+
+char* row_email(void* source, uint8_t* length) {
+
+    uint8_t username_length;
+    char* username = row_username(source, &username_length);
+    void* field = username + username_length;
+
+    *length = *(uint8_t*)field;
+    return field + STRING_LENGTH_SIZE;
+
+}
+
+/*
+    Function to print a row of the table
+*/
+void print_row(Row* row) {
+    printf("( %d, %s, %s )\n", row->id, row->username, row->email);
+} 
 
+/*
+    Functions to manage the buffer pool
+*/
+uint32_t pager_bucket(Pager* pager, uint32_t page_num) {
+    return (page_num * 2654435761u) & pager->page_table_mask;
+}
+
+uint32_t pager_lookup_frame(Pager* pager, uint32_t page_num) {
+
+    uint32_t index = pager->page_table[pager_bucket(pager, page_num)];
+
+    while (index != INVALID_FRAME && pager->frames[index].page_num != page_num) {
+        index = pager->frames[index].hash_next;
     }
 
-    if (cursor->cell_num < num_cells) {
+    return index;
 
-        // Make room for new cell
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), 
-                    LEAF_NODE_CELL_SIZE);
-        
-        }
+}
+
+void pager_remove_frame(Pager* pager, uint32_t frame_index) {
+
+    uint32_t* link = &pager->page_table[
+                        pager_bucket(pager, pager->frames[frame_index].page_num)];
 
+    while (*link != frame_index) {
+        link = &pager->frames[*link].hash_next;
     }
 
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    *link = pager->frames[frame_index].hash_next;
+    pager->frames[frame_index].page_num = INVALID_PAGE_NUM;
 
 }
 
-/* Cursor functions are peroformed by the following two funtions 
-    - Create a cursor at the beginning of the table
-    - Create a cursor at the end of the table
-    - Access the elements of the row pointed by the cursor
-    - Advance the cursor to the next row
+/*
+    Function to account for the page of a frame being written back,
+    by any of the write paths. The file covers the page from then on
 */
-Cursor* table_start(Table* table) {
+void pager_frame_written(Pager* pager, Frame* frame) {
 
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
-    cursor->cell_num = 0;
+    off_t end = ((off_t)frame->page_num + 1) * PAGE_SIZE;
 
-    void* root_node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->end_of_table = (num_cells == 0);
+    if (end > pager->file_length) {
+        pager->file_length = end;
+    }
 
-    return cursor;
+    frame->dirty = false;
+    pager->pages_written += 1;
 
 }
 
 /*
-    Function to binary search for a key in the leaf 
-    node since internal node has not been implemented 
-    yet
+    Function to write the page cached in a frame back to the file.
+    Takes up the complete page, even it's not full
 */
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+void pager_write_frame(Pager* pager, Frame* frame) {
 
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
+    off_t file_offset = (off_t)frame->page_num * PAGE_SIZE;
+    ssize_t bytes_written = 
+        pwrite(pager->file_descriptor, frame->data, PAGE_SIZE, file_offset);
+    
+    if (bytes_written == -1) {
 
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = page_num;
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    
+    }
 
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
+    pager_frame_written(pager, frame);
+
+}
 
-    while (min_index != one_past_max_index) {
+/*
+    Worker of the thread pool backend. Takes requests off the queue
+    and does the read or write with pread and pwrite, which do not
+    share a file offset between the threads
+*/
+void* async_io_worker(void* argument) {
 
-        uint32_t mid_index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_mid_index = *leaf_node_key(node, mid_index);
+    AsyncIo* io = argument;
 
-        if (key == key_at_mid_index) {
-            
-            cursor->cell_num = mid_index;
-            return cursor;
-        
+    pthread_mutex_lock(&io->lock);
+
+    while (true) {
+
+        while (io->queue_length == 0 && !io->shutdown) {
+            pthread_cond_wait(&io->work_ready, &io->lock);
+        }
+
+        if (io->queue_length == 0) {
+            break;
         }
 
-        if (key < key_at_mid_index) {
-            one_past_max_index = mid_index;
-        } 
+        IoRequest* request = &io->requests[io->queue[io->queue_head]];
+        io->queue_head = (io->queue_head + 1) % IO_QUEUE_DEPTH;
+        io->queue_length -= 1;
+
+        pthread_mutex_unlock(&io->lock);
 
+        ssize_t result;
+        if (request->write) {
+            result = pwritev(io->file_descriptor, request->iov, 
+                             request->num_pages, request->offset);
+        }
         else {
-            min_index = mid_index + 1;
+            result = pread(io->file_descriptor, request->iov[0].iov_base, 
+                           PAGE_SIZE, request->offset);
         }
 
+        pthread_mutex_lock(&io->lock);
+
+        request->result = (result == -1) ? -errno : result;
+        request->done = true;
+        pthread_cond_signal(&io->work_done);
+
     }
 
-    cursor->cell_num = min_index;
-    return cursor;
+    pthread_mutex_unlock(&io->lock);
+
+    return NULL;
 
 }
 
 /*
-    Return the position of the given key
-    If the key is not present, return the position
-    where it should be inserted
+    Function to set up an io_uring for the db file. Returns false
+    when the kernel has none, or one without the plain read and
+    write operations (those came with IORING_FEAT_RW_CUR_POS)
 */
-Cursor* table_find(Table* table, uint32_t key) {
+bool async_io_setup_uring(AsyncIo* io) {
 
-    uint32_t root_page_num = table->root_page_num;
-    void* root_node = get_page(table->pager, root_page_num);
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
 
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
+    int ring_fd = syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+    if (ring_fd == -1) {
+        return false;
     }
 
-    else {
-        printf("Need to implement searching an internal node.\n");
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring_fd);
+        return false;
+    }
+
+    io->ring_fd = ring_fd;
+    io->sq_ring_size = params.sq_off.array + 
+                       params.sq_entries * sizeof(unsigned);
+    io->cq_ring_size = params.cq_off.cqes + 
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings with a single mmap
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && io->cq_ring_size > io->sq_ring_size) {
+        io->sq_ring_size = io->cq_ring_size;
+    }
+
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    io->cq_ring = io->sq_ring;
+
+    if (!single_mmap && io->sq_ring != MAP_FAILED) {
+        io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd, 
+                           IORING_OFF_CQ_RING);
+    }
+
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+    if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || 
+        io->sqes == MAP_FAILED) {
+        printf("Unable to map the io_uring: %d\n", errno);
         exit(EXIT_FAILURE);
     }
 
+    io->sq_tail = io->sq_ring + params.sq_off.tail;
+    io->sq_mask = io->sq_ring + params.sq_off.ring_mask;
+    io->sq_array = io->sq_ring + params.sq_off.array;
+    io->cq_head = io->cq_ring + params.cq_off.head;
+    io->cq_tail = io->cq_ring + params.cq_off.tail;
+    io->cq_mask = io->cq_ring + params.cq_off.ring_mask;
+    io->cqes = io->cq_ring + params.cq_off.cqes;
+    io->unsubmitted = 0;
+
+    return true;
+
 }
 
-/* 
-    Function for pointing the position described by the cursor
+/*
+    Function to start the asynchronous I/O backend. An io_uring is
+    preferred, with the thread pool as the fallback
 */
-void* cursor_value(Cursor* cursor) {
+void async_io_open(AsyncIo* io, int file_descriptor, IoBackend backend) {
 
-    uint32_t page_num = cursor->page_num;
-    
-    void* page = get_page(cursor->table->pager, page_num);
+    io->backend = backend;
+    io->file_descriptor = file_descriptor;
+    io->in_flight = 0;
 
-    return leaf_node_value(page, cursor->cell_num);
+    for (uint32_t i = 0; i < IO_QUEUE_DEPTH; i++) {
+        io->requests[i].in_use = false;
+    }
+
+    if (io->backend == IO_URING && !async_io_setup_uring(io)) {
+        io->backend = IO_THREADS;
+    }
+
+    if (io->backend == IO_THREADS) {
+
+        pthread_mutex_init(&io->lock, NULL);
+        pthread_cond_init(&io->work_ready, NULL);
+        pthread_cond_init(&io->work_done, NULL);
+        io->queue_head = 0;
+        io->queue_length = 0;
+        io->shutdown = false;
+
+        for (uint32_t i = 0; i < IO_WORKER_THREADS; i++) {
+
+            if (pthread_create(&io->workers[i], NULL, 
+                               async_io_worker, io) != 0) {
+                printf("Unable to start an I/O thread.\n");
+                exit(EXIT_FAILURE);
+            }
+
+        }
+
+    }
 
 }
 
 /*
-    Function to advance the cursor to the next row in the table
+    Function to hand the queued io_uring requests to the kernel, and
+    wait for at least `min_complete` of the requests in flight
 */
-void cursor_advance(Cursor* cursor) {
+void async_io_enter(AsyncIo* io, uint32_t min_complete) {
 
-    uint32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
-    
-    cursor->cell_num += 1;
-    
-    if (cursor->cell_num >= *leaf_node_num_cells(node)) {
-        cursor->end_of_table = true;
+    uint32_t flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+    while (io->unsubmitted > 0 || min_complete > 0) {
+
+        int result = syscall(__NR_io_uring_enter, io->ring_fd, 
+                             io->unsubmitted, min_complete, flags, NULL, 0);
+
+        if (result == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Error submitting I/O: %d\n", errno);
+            exit(EXIT_FAILURE);
+
+        }
+
+        io->unsubmitted -= result;
+        min_complete = 0;
+        flags = 0;
+
+    }
+
+}
+
+/*
+    Function to apply a finished request to its frames. A read which
+    reached the end of the file leaves the rest of the page zeroed
+*/
+void pager_complete_io(Pager* pager, IoRequest* request) {
+
+    if (request->result < 0) {
+
+        printf("Error %s page: %d\n", request->write ? "writing" : "reading",
+               (int)-request->result);
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (request->write && request->result != request->num_pages * PAGE_SIZE) {
+
+        printf("Error writing page: short write\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (!request->write) {
+        memset(request->iov[0].iov_base + request->result, 0, 
+               PAGE_SIZE - request->result);
+    }
+
+    for (uint32_t i = 0; i < request->num_pages; i++) {
+
+        Frame* frame = &pager->frames[request->frame_indices[i]];
+        frame->io_pending = false;
+        frame->pin_count -= 1;
+
+    }
+
+    request->in_use = false;
+    pager->io.in_flight -= 1;
+
+}
+
+/*
+    Function to apply every finished request to its frame. With
+    `wait` set, blocks until at least one request has finished
+*/
+void async_io_reap(Pager* pager, bool wait) {
+
+    AsyncIo* io = &pager->io;
+
+    if (io->in_flight == 0) {
+        return;
     }
 
+    if (io->backend == IO_URING) {
+
+        if (wait && 
+            __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE) == *io->cq_head) {
+            async_io_enter(io, 1);
+        }
+
+        unsigned head = *io->cq_head;
+        unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+
+            struct io_uring_cqe* cqe = &io->cqes[head & *io->cq_mask];
+            IoRequest* request = &io->requests[cqe->user_data];
+            request->result = cqe->res;
+            pager_complete_io(pager, request);
+            head += 1;
+
+        }
+
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+        return;
+
+    }
+
+    pthread_mutex_lock(&io->lock);
+
+    bool reaped = false;
+
+    while (!reaped) {
+
+        for (uint32_t i = 0; i < IO_QUEUE_DEPTH; i++) {
+
+            IoRequest* request = &io->requests[i];
+
+            if (request->in_use && request->done) {
+                pager_complete_io(pager, request);
+                reaped = true;
+            }
+
+        }
+
+        if (!wait) {
+            break;
+        }
+
+        if (!reaped) {
+            pthread_cond_wait(&io->work_done, &io->lock);
+        }
+
+    }
+
+    pthread_mutex_unlock(&io->lock);
+
+}
+
+/*
+    Function to start a write of the pages cached in `num_pages`
+    frames, of adjacent pages in page order, or a read of the page
+    of one frame. The frames stay pinned until the request is 
+    reaped. io_uring requests are queued until async_io_enter(), so
+    a run of submissions goes to the kernel in one system call
+*/
+void async_io_submit_run(Pager* pager, uint32_t* frame_indices, 
+                         uint32_t num_pages, bool write) {
+
+    AsyncIo* io = &pager->io;
+
+    while (io->in_flight == IO_QUEUE_DEPTH) {
+
+        if (io->backend == IO_URING) {
+            async_io_enter(io, 0);
+        }
+
+        async_io_reap(pager, true);
+
+    }
+
+    uint32_t request_index = 0;
+    while (io->requests[request_index].in_use) {
+        request_index++;
+    }
+
+    IoRequest* request = &io->requests[request_index];
+    request->in_use = true;
+    request->write = write;
+    request->done = false;
+    request->num_pages = num_pages;
+    request->offset = (off_t)pager->frames[frame_indices[0]].page_num * PAGE_SIZE;
+    io->in_flight += 1;
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+
+        Frame* frame = &pager->frames[frame_indices[i]];
+        frame->io_pending = true;
+        frame->pin_count += 1;
+
+        request->frame_indices[i] = frame_indices[i];
+        request->iov[i].iov_base = frame->data;
+        request->iov[i].iov_len = PAGE_SIZE;
+
+    }
+
+    if (io->backend == IO_URING) {
+
+        unsigned tail = *io->sq_tail;
+        unsigned slot = tail & *io->sq_mask;
+        struct io_uring_sqe* sqe = &io->sqes[slot];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = io->file_descriptor;
+        sqe->off = request->offset;
+        sqe->user_data = request_index;
+
+        if (write) {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (uint64_t)(uintptr_t)request->iov;
+            sqe->len = num_pages;
+        }
+        else {
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)request->iov[0].iov_base;
+            sqe->len = PAGE_SIZE;
+        }
+
+        io->sq_array[slot] = slot;
+        __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        io->unsubmitted += 1;
+        return;
+
+    }
+
+    pthread_mutex_lock(&io->lock);
+    io->queue[(io->queue_head + io->queue_length) % IO_QUEUE_DEPTH] = 
+        request_index;
+    io->queue_length += 1;
+    pthread_cond_signal(&io->work_ready);
+    pthread_mutex_unlock(&io->lock);
+
+}
+
+void async_io_submit(Pager* pager, uint32_t frame_index, bool write) {
+    async_io_submit_run(pager, &frame_index, 1, write);
+}
+
+/*
+    Function to wait for every request in flight
+*/
+void async_io_drain(Pager* pager) {
+
+    if (pager->io.backend == IO_URING) {
+        async_io_enter(&pager->io, 0);
+    }
+
+    while (pager->io.in_flight > 0) {
+        async_io_reap(pager, true);
+    }
+
+}
+
+/*
+    Function to wait for the request in flight on a frame
+*/
+void async_io_wait_frame(Pager* pager, uint32_t frame_index) {
+
+    if (pager->io.backend == IO_URING) {
+        async_io_enter(&pager->io, 0);
+    }
+
+    while (pager->frames[frame_index].io_pending) {
+        async_io_reap(pager, true);
+    }
+
+}
+
+/*
+    Function to finish the requests in flight and stop the backend
+*/
+void async_io_close(Pager* pager) {
+
+    AsyncIo* io = &pager->io;
+
+    async_io_drain(pager);
+
+    if (io->backend == IO_URING) {
+
+        munmap(io->sqes, io->sqes_size);
+        if (io->cq_ring != io->sq_ring) {
+            munmap(io->cq_ring, io->cq_ring_size);
+        }
+        munmap(io->sq_ring, io->sq_ring_size);
+        close(io->ring_fd);
+
+    }
+    else if (io->backend == IO_THREADS) {
+
+        pthread_mutex_lock(&io->lock);
+        io->shutdown = true;
+        pthread_cond_broadcast(&io->work_ready);
+        pthread_mutex_unlock(&io->lock);
+
+        for (uint32_t i = 0; i < IO_WORKER_THREADS; i++) {
+            pthread_join(io->workers[i], NULL);
+        }
+
+        pthread_mutex_destroy(&io->lock);
+        pthread_cond_destroy(&io->work_ready);
+        pthread_cond_destroy(&io->work_done);
+
+    }
+
+}
+
+int compare_page_frames(const void* a, const void* b) {
+
+    uint64_t page_frame_a = *(const uint64_t*)a;
+    uint64_t page_frame_b = *(const uint64_t*)b;
+
+    return (page_frame_a > page_frame_b) - (page_frame_a < page_frame_b);
+
+}
+
+/*
+    Function to write a run of adjacent pages, cached in frames given
+    in page order, with one vectored write
+*/
+void pager_write_run(Pager* pager, uint32_t* frame_indices, uint32_t num_pages) {
+
+    struct iovec iov[IO_MAX_RUN_PAGES];
+    off_t file_offset = (off_t)pager->frames[frame_indices[0]].page_num * PAGE_SIZE;
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        iov[i].iov_base = pager->frames[frame_indices[i]].data;
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    uint32_t first = 0;
+
+    while (first < num_pages) {
+
+        ssize_t bytes_written = pwritev(pager->file_descriptor, iov + first,
+                                        num_pages - first, file_offset);
+
+        if (bytes_written == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Error writing: %d\n", errno);
+            exit(EXIT_FAILURE);
+
+        }
+
+        // A short write goes on from where it stopped
+        file_offset += bytes_written;
+
+        while (first < num_pages && bytes_written >= (ssize_t)iov[first].iov_len) {
+            bytes_written -= iov[first].iov_len;
+            first++;
+        }
+
+        if (first < num_pages) {
+            iov[first].iov_base += bytes_written;
+            iov[first].iov_len -= bytes_written;
+        }
+
+    }
+
+}
+
+/*
+    Function to write every dirty page of the buffer pool back to
+    the file, and only those. The pages are written in page order,
+    each run of adjacent pages with one vectored write, so the time
+    taken follows the pages changed rather than the size of the pool.
+    With an asynchronous backend the runs are submitted together and
+    waited for as a batch
+*/
+void pager_write_dirty_frames(Pager* pager) {
+
+    // Dirty frames as page number << 32 | frame index, to sort them
+    uint64_t* dirty = malloc(pager->num_frames * sizeof(uint64_t));
+    uint32_t num_dirty = 0;
+
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+
+        Frame* frame = &pager->frames[i];
+
+        if (frame->page_num != INVALID_PAGE_NUM && frame->dirty) {
+            dirty[num_dirty++] = ((uint64_t)frame->page_num << 32) | i;
+        }
+
+    }
+
+    qsort(dirty, num_dirty, sizeof(uint64_t), compare_page_frames);
+
+    uint32_t run[IO_MAX_RUN_PAGES];
+
+    for (uint32_t i = 0; i < num_dirty; ) {
+
+        uint32_t num_pages = 0;
+
+        do {
+            run[num_pages++] = (uint32_t)dirty[i++];
+        } while (i < num_dirty && num_pages < IO_MAX_RUN_PAGES &&
+                 (dirty[i] >> 32) == (dirty[i - 1] >> 32) + 1);
+
+        for (uint32_t j = 0; j < num_pages; j++) {
+            pager_frame_written(pager, &pager->frames[run[j]]);
+        }
+
+        if (pager->io.backend == IO_SYNC) {
+            pager_write_run(pager, run, num_pages);
+        }
+        else {
+            async_io_submit_run(pager, run, num_pages, true);
+        }
+
+    }
+
+    if (pager->io.backend != IO_SYNC) {
+        async_io_drain(pager);
+    }
+
+    free(dirty);
+
+}
+
+/*
+    Write-ahead log record layout. Every record holds a page image.
+    The last record of a statement is its commit record, which holds
+    the number of pages in the db after the statement; it is 0 in
+    the other records.
+*/
+const uint32_t WAL_MAGIC_OFFSET = 0;
+const uint32_t WAL_PAGE_NUM_OFFSET = WAL_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t WAL_COMMIT_OFFSET = WAL_PAGE_NUM_OFFSET + sizeof(uint32_t);
+const uint32_t WAL_CHECKSUM_OFFSET = WAL_COMMIT_OFFSET + sizeof(uint32_t);
+const uint32_t WAL_RECORD_HEADER_SIZE = WAL_CHECKSUM_OFFSET + sizeof(uint32_t);
+const uint32_t WAL_RECORD_SIZE = WAL_RECORD_HEADER_SIZE + PAGE_SIZE;
+
+/*
+    FNV-1a checksum of a record, covering its page number, commit
+    field and page image, so torn records at the tail are detected
+*/
+uint32_t wal_checksum(void* record) {
+
+    uint32_t hash = 2166136261u;
+    uint8_t* bytes = record + WAL_PAGE_NUM_OFFSET;
+
+    for (uint32_t i = 0; i < 2 * sizeof(uint32_t); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    bytes = record + WAL_RECORD_HEADER_SIZE;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    return hash;
+
+}
+
+/*
+    Write the buffered records to the log file, without syncing
+*/
+void wal_write_buffer(Pager* pager) {
+
+    if (pager->wal_buffer_length > 0) {
+
+        ssize_t bytes_written = write(pager->wal_file_descriptor, 
+                                      pager->wal_buffer,
+                                      pager->wal_buffer_length);
+
+        if (bytes_written != pager->wal_buffer_length) {
+            printf("Error writing the log: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pager->wal_buffer_length = 0;
+
+    }
+
+}
+
+/*
+    Group commit. Write the buffered records and make them durable
+    with a single fdatasync, releasing the threads waiting for it
+*/
+void wal_sync(Pager* pager) {
+
+    wal_write_buffer(pager);
+
+    if (pager->wal_logged > pager->wal_durable) {
+
+        if (fdatasync(pager->wal_file_descriptor) == -1) {
+            printf("Error syncing the log: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    pager->wal_durable = pager->wal_logged;
+    pthread_cond_broadcast(&pager->wal_synced);
+
+}
+
+/*
+    Append a page image to the log buffer. A full buffer is written
+    out first, so a large statement does not hold its whole log in
+    memory; recovery ignores records without their commit record
+*/
+void wal_append(Pager* pager, uint32_t page_num, void* page, 
+                uint32_t commit_num_pages) {
+
+    if (pager->wal_buffer_length + WAL_RECORD_SIZE > 
+        pager->wal_buffer_capacity) {
+        wal_write_buffer(pager);
+    }
+
+    void* record = pager->wal_buffer + pager->wal_buffer_length;
+    *(uint32_t*)(record + WAL_MAGIC_OFFSET) = WAL_MAGIC;
+    *(uint32_t*)(record + WAL_PAGE_NUM_OFFSET) = page_num;
+    *(uint32_t*)(record + WAL_COMMIT_OFFSET) = commit_num_pages;
+    memcpy(record + WAL_RECORD_HEADER_SIZE, page, PAGE_SIZE);
+    *(uint32_t*)(record + WAL_CHECKSUM_OFFSET) = wal_checksum(record);
+
+    pager->wal_buffer_length += WAL_RECORD_SIZE;
+    pager->wal_records += 1;
+
+}
+
+/*
+    Replay the committed statements of a log into the db file.
+    Records of a statement are applied once its commit record is
+    read; a torn or missing commit record ends the replay.
+*/
+void wal_recover(int file_descriptor, int wal_file_descriptor) {
+
+    off_t wal_length = lseek(wal_file_descriptor, 0, SEEK_END);
+    void* record = malloc(WAL_RECORD_SIZE);
+    off_t statement_start = 0;
+    uint32_t replayed = 0;
+
+    for (off_t offset = 0; offset + WAL_RECORD_SIZE <= wal_length;
+         offset += WAL_RECORD_SIZE) {
+
+        if (pread(wal_file_descriptor, record, WAL_RECORD_SIZE, offset) 
+                != WAL_RECORD_SIZE ||
+            *(uint32_t*)(record + WAL_MAGIC_OFFSET) != WAL_MAGIC ||
+            *(uint32_t*)(record + WAL_CHECKSUM_OFFSET) != wal_checksum(record)) {
+            break;
+        }
+
+        if (*(uint32_t*)(record + WAL_COMMIT_OFFSET) == 0) {
+            continue;
+        }
+
+        // Commit record. Apply the statement's page images
+        for (off_t apply = statement_start; apply <= offset; 
+             apply += WAL_RECORD_SIZE) {
+
+            pread(wal_file_descriptor, record, WAL_RECORD_SIZE, apply);
+            uint32_t page_num = *(uint32_t*)(record + WAL_PAGE_NUM_OFFSET);
+
+            if (pwrite(file_descriptor, record + WAL_RECORD_HEADER_SIZE, 
+                       PAGE_SIZE, (off_t)page_num * PAGE_SIZE) != PAGE_SIZE) {
+                printf("Error replaying the log: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+
+        }
+
+        statement_start = offset + WAL_RECORD_SIZE;
+        replayed += 1;
+
+    }
+
+    free(record);
+
+    if (replayed > 0 && fdatasync(file_descriptor) == -1) {
+        printf("Error syncing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ftruncate(wal_file_descriptor, 0) == -1 || 
+        fsync(wal_file_descriptor) == -1) {
+        printf("Error truncating the log: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+}
+
+/*
+    Checkpoint. Write every dirty page back into the db file, then
+    start an empty log, since the db file now holds what it covered
+*/
+void wal_checkpoint(Pager* pager) {
+
+    wal_sync(pager);
+    pager_write_dirty_frames(pager);
+
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ftruncate(pager->wal_file_descriptor, 0) == -1 ||
+        lseek(pager->wal_file_descriptor, 0, SEEK_SET) == -1 ||
+        fsync(pager->wal_file_descriptor) == -1) {
+        printf("Error truncating the log: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    pager->wal_records = 0;
+
+}
+
+uint32_t pager_new_frame(Pager* pager) {
+
+    if (pager->num_frames == pager->frames_capacity) {
+
+        pager->frames_capacity *= 2;
+        pager->frames = realloc(pager->frames, 
+                                pager->frames_capacity * sizeof(Frame));
+
+    }
+
+    Frame* frame = &pager->frames[pager->num_frames];
+    frame->page_num = INVALID_PAGE_NUM;
+    frame->pin_count = 0;
+    frame->dirty = false;
+    frame->referenced = false;
+    frame->wal_pending = false;
+    frame->statement_pinned = false;
+    frame->io_pending = false;
+    frame->loading = false;
+    frame->latch = malloc(sizeof(pthread_rwlock_t));
+    pthread_rwlock_init(frame->latch, NULL);
+    frame->data = malloc(PAGE_SIZE);
+
+    return pager->num_frames++;
+
+}
+
+/*
+    Function to find a frame for a page which is not cached.
+    Frames are handed out until the pool is full, then the CLOCK
+    hand sweeps for an unpinned frame whose reference bit is clear,
+    writing it back first if it is dirty. Pages modified by the 
+    statement being executed are not evicted before they are logged.
+    Without `evict_dirty` only clean frames are taken, for threads
+    which may not wait for the log. Returns INVALID_FRAME when no
+    frame can be evicted.
+*/
+uint32_t pager_find_victim(Pager* pager, bool evict_dirty) {
+
+    if (pager->num_frames < pager->pool_size) {
+        return pager_new_frame(pager);
+    }
+
+    for (uint32_t sweep = 0; sweep < 2 * pager->num_frames; sweep++) {
+
+        uint32_t index = pager->clock_hand;
+        Frame* frame = &pager->frames[index];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+        if (frame->pin_count > 0 || frame->wal_pending) {
+            continue;
+        }
+
+        if (frame->referenced) {
+
+            frame->referenced = false;
+            continue;
+
+        }
+
+        if (frame->dirty && !evict_dirty) {
+            continue;
+        }
+
+        if (frame->dirty) {
+
+            // The log must be durable before the page it covers
+            if (pager->wal_enabled) {
+                wal_sync(pager);
+            }
+
+            pager_write_frame(pager, frame);
+
+        }
+
+        pager_remove_frame(pager, index);
+        return index;
+
+    }
+
+    return INVALID_FRAME;
+
+}
+
+/*
+Get the frame of a page and handle a cache miss
+*/
+uint32_t pager_load_frame(Pager* pager, uint32_t page_num, bool evict_dirty) {
+
+    if (page_num == INVALID_PAGE_NUM) {
+        printf("Tried to fetch an invalid page number.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t index = pager_lookup_frame(pager, page_num);
+
+    if (index != INVALID_FRAME && pager->frames[index].io_pending) {
+        async_io_wait_frame(pager, index);
+    }
+
+    if (index == INVALID_FRAME) {
+
+        // Finished read-ahead releases its frames for the victim search
+        async_io_reap(pager, false);
+
+        /*
+            A cache miss. Take a frame and load from file. When every
+            frame is pinned the pool grows past its size, until the
+            statement ends
+        */
+        index = pager_find_victim(pager, evict_dirty);
+        if (index == INVALID_FRAME) {
+            index = pager_new_frame(pager);
+        }
+        Frame* frame = &pager->frames[index];
+        off_t file_offset = (off_t)page_num * PAGE_SIZE;
+        ssize_t bytes_read = 0;
+
+        // Pages past the end of the file have not been written yet
+        if (file_offset < pager->file_length) {
+
+            bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE,
+                               file_offset);
+        
+            if (bytes_read == -1) {
+                printf("Error reading file: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+
+            pager->pages_read += 1;
+
+        }
+
+        memset(frame->data + bytes_read, 0, PAGE_SIZE - bytes_read);
+
+        frame->page_num = page_num;
+        frame->dirty = false;
+        uint32_t bucket = pager_bucket(pager, page_num);
+        frame->hash_next = pager->page_table[bucket];
+        pager->page_table[bucket] = index;
+
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
+    
+    }
+
+    pager->frames[index].referenced = true;
+
+    return index;
+
+}
+
+uint32_t pager_fetch_frame(Pager* pager, uint32_t page_num) {
+    return pager_load_frame(pager, page_num, true);
+}
+
+/*
+    Function to start reading a page into the buffer pool ahead of
+    its use. Pages which are cached, past the end of the file, or
+    would have to wait for a free request or a frame are skipped,
+    so read-ahead never grows the pool. In the memory-mapped mode
+    the kernel is asked to read the page in.
+*/
+void pager_prefetch(Pager* pager, uint32_t page_num) {
+
+    off_t file_offset = (off_t)page_num * PAGE_SIZE;
+
+    if (pager->mode == PAGER_MMAP) {
+
+        if (file_offset < pager->file_length) {
+            madvise(pager->map + file_offset, PAGE_SIZE, MADV_WILLNEED);
+        }
+
+        return;
+
+    }
+
+    if (pager->io.backend == IO_SYNC || 
+        pager->io.in_flight == IO_QUEUE_DEPTH ||
+        file_offset >= pager->file_length ||
+        pager_lookup_frame(pager, page_num) != INVALID_FRAME) {
+        return;
+    }
+
+    uint32_t index = pager_find_victim(pager, true);
+    if (index == INVALID_FRAME) {
+        return;
+    }
+    Frame* frame = &pager->frames[index];
+
+    frame->page_num = page_num;
+    frame->dirty = false;
+    frame->referenced = true;
+    uint32_t bucket = pager_bucket(pager, page_num);
+    frame->hash_next = pager->page_table[bucket];
+    pager->page_table[bucket] = index;
+
+    pager->pages_read += 1;
+    async_io_submit(pager, index, false);
+
+}
+
+/*
+    Functions for the memory-mapped pager mode. The mapping covers
+    MMAP_RESERVE_SIZE bytes from the start, so page pointers stay
+    valid while the file is extended underneath it. The file grows
+    geometrically and is trimmed back to num_pages on close.
+*/
+void* pager_mmap_page(Pager* pager, uint32_t page_num) {
+
+    off_t needed_length = ((off_t)page_num + 1) * PAGE_SIZE;
+
+    if (needed_length > pager->file_length) {
+
+        if (needed_length > MMAP_RESERVE_SIZE) {
+            printf("Db file is larger than the memory map.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        off_t growth = pager->file_length;
+        if (growth > MMAP_MAX_GROWTH) {
+            growth = MMAP_MAX_GROWTH;
+        }
+
+        off_t new_length = pager->file_length + growth;
+        if (new_length < needed_length) {
+            new_length = needed_length;
+        }
+        if (new_length > MMAP_RESERVE_SIZE) {
+            new_length = MMAP_RESERVE_SIZE;
+        }
+
+        if (ftruncate(pager->file_descriptor, new_length) == -1) {
+            printf("Error extending file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pager->file_length = new_length;
+
+    }
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+
+    return pager->map + (off_t)page_num * PAGE_SIZE;
+
+}
+
+/*
+    Get a page, pinned in the buffer pool until the end of the
+    current statement, or until pager_unpin_to() releases it, so
+    the pointer stays valid while other pages are fetched
+*/
+void* get_page(Pager* pager, uint32_t page_num) {
+
+    if (pager->mode == PAGER_MMAP) {
+        return pager_mmap_page(pager, page_num);
+    }
+
+    uint32_t index = pager_fetch_frame(pager, page_num);
+    Frame* frame = &pager->frames[index];
+
+    if (!frame->statement_pinned) {
+
+        if (pager->num_statement_pins == pager->statement_pins_capacity) {
+
+            pager->statement_pins_capacity *= 2;
+            pager->statement_pins = realloc(pager->statement_pins,
+                            pager->statement_pins_capacity * sizeof(uint32_t));
+
+        }
+
+        frame->pin_count += 1;
+        frame->statement_pinned = true;
+        pager->statement_pins[pager->num_statement_pins++] = index;
+
+    }
+
+    return frame->data;
+
+}
+
+/*
+    Get a page without pinning it. The pointer is only valid
+    until the next page is fetched, which is all a cursor needs
+    while it steps through the rows of a leaf
+*/
+void* get_page_unpinned(Pager* pager, uint32_t page_num) {
+
+    if (pager->mode == PAGER_MMAP) {
+        return pager_mmap_page(pager, page_num);
+    }
+
+    // The frames array may be reallocated by the fetch
+    uint32_t index = pager_fetch_frame(pager, page_num);
+    return pager->frames[index].data;
+
+}
+
+/*
+    Functions to release the pins taken by get_page(). A statement
+    working through rows one at a time takes a mark before each row
+    and releases the pages the row used when it is done with them
+*/
+uint32_t pager_pin_mark(Pager* pager) {
+    return pager->num_statement_pins;
+}
+
+void pager_unpin_to(Pager* pager, uint32_t mark) {
+
+    for (uint32_t i = mark; i < pager->num_statement_pins; i++) {
+
+        Frame* frame = &pager->frames[pager->statement_pins[i]];
+        frame->pin_count -= 1;
+        frame->statement_pinned = false;
+
+    }
+
+    pager->num_statement_pins = mark;
+
+}
+
+/*
+    Function to free the frames added past pool_size while every
+    frame was pinned. Their pages move into frames of the pool which
+    CLOCK evicts for them, or are evicted when there are none
+*/
+void pager_shrink(Pager* pager) {
+
+    if (pager->num_frames <= pager->pool_size) {
+        return;
+    }
+
+    // Read-ahead may still be filling some of them
+    async_io_drain(pager);
+
+    while (pager->num_frames > pager->pool_size) {
+
+        uint32_t index = pager->num_frames - 1;
+        Frame* frame = &pager->frames[index];
+
+        if (frame->pin_count > 0 || frame->wal_pending) {
+            break;
+        }
+
+        if (frame->page_num != INVALID_PAGE_NUM) {
+
+            // The victim search only sees the frames below this one
+            pager->num_frames -= 1;
+            pager->clock_hand %= pager->num_frames;
+            uint32_t victim_index = pager_find_victim(pager, true);
+            pager->num_frames += 1;
+
+            if (victim_index != INVALID_FRAME) {
+
+                Frame* victim = &pager->frames[victim_index];
+                void* data = victim->data;
+                uint32_t page_num = frame->page_num;
+
+                victim->data = frame->data;
+                victim->dirty = frame->dirty;
+                victim->referenced = frame->referenced;
+                frame->data = data;
+                pager_remove_frame(pager, index);
+
+                victim->page_num = page_num;
+                uint32_t bucket = pager_bucket(pager, page_num);
+                victim->hash_next = pager->page_table[bucket];
+                pager->page_table[bucket] = victim_index;
+
+            }
+            else {
+
+                if (frame->dirty) {
+
+                    if (pager->wal_enabled) {
+                        wal_sync(pager);
+                    }
+
+                    pager_write_frame(pager, frame);
+
+                }
+
+                pager_remove_frame(pager, index);
+
+            }
+
+        }
+
+        frame = &pager->frames[index];
+        pthread_rwlock_destroy(frame->latch);
+        free(frame->latch);
+        free(frame->data);
+        pager->num_frames -= 1;
+
+    }
+
+    pager->clock_hand %= pager->num_frames;
+
+}
+
+void pager_unpin_all(Pager* pager) {
+
+    pager_unpin_to(pager, 0);
+    pager_shrink(pager);
+
+}
+
+/*
+    Function to mark the page of a frame as modified
+*/
+void pager_frame_dirty(Pager* pager, uint32_t index) {
+
+    Frame* frame = &pager->frames[index];
+    frame->dirty = true;
+
+    // Remember the page so the statement logs it when it finishes
+    if (pager->wal_enabled && !frame->wal_pending) {
+
+        if (pager->num_wal_pending == pager->wal_pending_capacity) {
+
+            pager->wal_pending_capacity *= 2;
+            pager->wal_pending = realloc(pager->wal_pending,
+                            pager->wal_pending_capacity * sizeof(uint32_t));
+
+        }
+
+        frame->wal_pending = true;
+        pager->wal_pending[pager->num_wal_pending++] = index;
+
+    }
+
+}
+
+/*
+    Mark a cached page as modified, so it is written back before
+    its frame is reused and when the database is closed
+*/
+void mark_page_dirty(Pager* pager, uint32_t page_num) {
+
+    // Writes to the mapping go straight to the kernel page cache
+    if (pager->mode == PAGER_MMAP) {
+        return;
+    }
+
+    pager_frame_dirty(pager, pager_fetch_frame(pager, page_num));
+
+}
+
+/*
+    Function for a thread sharing the pool to load a page which is
+    not cached. A clean frame is taken when there is one. Otherwise
+    the log is synced under wal_lock, which keeps a commit from
+    logging meanwhile, and a dirty frame is written back; the pool
+    only grows when every frame is pinned. The page is read with
+    pool_lock released, its frame pinned and marked loading, so the
+    misses of other threads go on meanwhile. Called and returns with
+    pool_lock held; when the page was loaded by another thread while
+    pool_lock was released, its frame is returned instead.
+*/
+uint32_t pager_load_shared(Pager* pager, uint32_t page_num) {
+
+    // Finished read-ahead releases its frames for the victim search
+    async_io_reap(pager, false);
+
+    uint32_t index = pager_find_victim(pager, !pager->wal_enabled);
+
+    if (index == INVALID_FRAME && pager->wal_enabled) {
+
+        pthread_mutex_unlock(&pager->pool_lock);
+        pthread_mutex_lock(&pager->wal_lock);
+        wal_sync(pager);
+        pthread_mutex_lock(&pager->pool_lock);
+
+        index = pager_lookup_frame(pager, page_num);
+
+        if (index != INVALID_FRAME) {
+
+            pthread_mutex_unlock(&pager->wal_lock);
+            return index;
+
+        }
+
+        index = pager_find_victim(pager, true);
+        pthread_mutex_unlock(&pager->wal_lock);
+
+    }
+
+    if (index == INVALID_FRAME) {
+        index = pager_new_frame(pager);
+    }
+
+    Frame* frame = &pager->frames[index];
+    frame->page_num = page_num;
+    frame->dirty = false;
+    frame->loading = true;
+    frame->pin_count += 1;
+    uint32_t bucket = pager_bucket(pager, page_num);
+    frame->hash_next = pager->page_table[bucket];
+    pager->page_table[bucket] = index;
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+
+    // Pages past the end of the file have not been written yet
+    void* data = frame->data;
+    off_t file_offset = (off_t)page_num * PAGE_SIZE;
+    bool read_page = file_offset < pager->file_length;
+
+    pthread_mutex_unlock(&pager->pool_lock);
+
+    ssize_t bytes_read = 0;
+
+    if (read_page) {
+
+        bytes_read = pread(pager->file_descriptor, data, PAGE_SIZE, 
+                           file_offset);
+
+        if (bytes_read == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    memset(data + bytes_read, 0, PAGE_SIZE - bytes_read);
+
+    pthread_mutex_lock(&pager->pool_lock);
+
+    // The frames array may have been reallocated meanwhile
+    frame = &pager->frames[index];
+    frame->loading = false;
+    frame->pin_count -= 1;
+
+    if (read_page) {
+        pager->pages_read += 1;
+    }
+
+    pthread_cond_broadcast(&pager->frame_loaded);
+
+    return index;
+
+}
+
+/*
+    Functions for pages used by several threads at once. A page is
+    pinned under pool_lock, then latched outside of it, so a thread
+    waiting for a latch does not hold up the rest of the pool.
+*/
+void* pager_fix_page(Pager* pager, uint32_t page_num, LatchMode mode,
+                     PageHandle* handle) {
+
+    handle->mode = mode;
+
+    if (pager->mode == PAGER_MMAP) {
+
+        // Threads only share the mapping while no page is written
+        handle->frame_index = INVALID_FRAME;
+        handle->latch = NULL;
+        handle->data = pager->map + (off_t)page_num * PAGE_SIZE;
+        return handle->data;
+
+    }
+
+    if (page_num == INVALID_PAGE_NUM) {
+        printf("Tried to fetch an invalid page number.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&pager->pool_lock);
+
+    uint32_t index = pager_lookup_frame(pager, page_num);
+
+    while (index == INVALID_FRAME || pager->frames[index].loading) {
+
+        if (index == INVALID_FRAME) {
+            index = pager_load_shared(pager, page_num);
+        }
+        else {
+
+            // Another thread is reading the page in
+            pthread_cond_wait(&pager->frame_loaded, &pager->pool_lock);
+            index = pager_lookup_frame(pager, page_num);
+
+        }
+
+    }
+
+    if (pager->frames[index].io_pending) {
+        async_io_wait_frame(pager, index);
+    }
+
+    Frame* frame = &pager->frames[index];
+    frame->pin_count += 1;
+    frame->referenced = true;
+
+    handle->frame_index = index;
+    handle->latch = frame->latch;
+    handle->data = frame->data;
+
+    pthread_mutex_unlock(&pager->pool_lock);
+
+    if (mode == LATCH_WRITE) {
+        pthread_rwlock_wrlock(handle->latch);
+    }
+    else {
+        pthread_rwlock_rdlock(handle->latch);
+    }
+
+    return handle->data;
+
+}
+
+/*
+    Function to release the latch of a fixed page, keeping it pinned
+*/
+void pager_unlatch_page(PageHandle* handle) {
+
+    if (handle->latch != NULL) {
+        pthread_rwlock_unlock(handle->latch);
+    }
+
+}
+
+/*
+    Function to trade the latch of a fixed page for one in the other
+    mode. The page may change in between, but no other thread can
+    split or merge it while the tree latch is held shared.
+*/
+void pager_relatch_page(PageHandle* handle, LatchMode mode) {
+
+    if (handle->latch != NULL && handle->mode != mode) {
+
+        pthread_rwlock_unlock(handle->latch);
+
+        if (mode == LATCH_WRITE) {
+            pthread_rwlock_wrlock(handle->latch);
+        }
+        else {
+            pthread_rwlock_rdlock(handle->latch);
+        }
+
+    }
+
+    handle->mode = mode;
+
+}
+
+void pager_unpin_page(Pager* pager, PageHandle* handle) {
+
+    if (handle->frame_index != INVALID_FRAME) {
+
+        pthread_mutex_lock(&pager->pool_lock);
+        pager->frames[handle->frame_index].pin_count -= 1;
+        pthread_mutex_unlock(&pager->pool_lock);
+
+    }
+
+}
+
+void pager_unfix_page(Pager* pager, PageHandle* handle) {
+
+    pager_unlatch_page(handle);
+    pager_unpin_page(pager, handle);
+
+}
+
+/*
+    Function to mark a page fixed for writing as modified. Called
+    before its latch is released, so a commit of another thread
+    which logs the page waits until the change is complete
+*/
+void pager_mark_fixed_dirty(Pager* pager, PageHandle* handle) {
+
+    if (handle->frame_index == INVALID_FRAME) {
+        return;
+    }
+
+    pthread_mutex_lock(&pager->pool_lock);
+    pager_frame_dirty(pager, handle->frame_index);
+    pthread_mutex_unlock(&pager->pool_lock);
+
+}
+
+/*
+    Function to append the pages modified since the last commit to
+    the log, ending with a commit record. Writers of other threads
+    go on adding to an empty list while the taken one is logged,
+    and each page is read under its latch, so a page being changed
+    is logged after the change. The pages are not evicted before
+    they are logged: they are pinned, or the frames are dirty and
+    other threads only evict dirty frames under wal_lock. Returns whether the log
+    has grown enough for a checkpoint.
+*/
+bool wal_log_pending(Pager* pager) {
+
+    if (!pager->wal_enabled) {
+        return false;
+    }
+
+    pthread_mutex_lock(&pager->wal_lock);
+    pthread_mutex_lock(&pager->pool_lock);
+
+    uint32_t* pending = pager->wal_pending;
+    uint32_t num_pending = pager->num_wal_pending;
+    uint32_t pending_capacity = pager->wal_pending_capacity;
+
+    pager->wal_pending = pager->wal_logging;
+    pager->wal_pending_capacity = pager->wal_logging_capacity;
+    pager->num_wal_pending = 0;
+    pager->wal_logging = pending;
+    pager->wal_logging_capacity = pending_capacity;
+
+    for (uint32_t i = 0; i < num_pending; i++) {
+        pager->frames[pending[i]].wal_pending = false;
+    }
+
+    pthread_mutex_unlock(&pager->pool_lock);
+
+    for (uint32_t i = 0; i < num_pending; i++) {
+
+        // The frames array may be reallocated by other threads
+        pthread_mutex_lock(&pager->pool_lock);
+        Frame frame = pager->frames[pending[i]];
+        pthread_mutex_unlock(&pager->pool_lock);
+
+        bool last = (i == num_pending - 1);
+
+        pthread_rwlock_rdlock(frame.latch);
+        wal_append(pager, frame.page_num, frame.data,
+                   last ? pager->num_pages : 0);
+        pthread_rwlock_unlock(frame.latch);
+
+    }
+
+    if (num_pending > 0) {
+
+        pager->wal_logged += 1;
+
+        if (pager->wal_logged - pager->wal_durable >= pager->wal_group_commit) {
+            wal_sync(pager);
+        }
+
+    }
+
+    bool checkpoint = pager->wal_records >= WAL_CHECKPOINT_RECORDS;
+
+    pthread_mutex_unlock(&pager->wal_lock);
+
+    return checkpoint;
+
+}
+
+/*
+    Finish a statement. The pages it modified are still pinned, so
+    none of them has reached the db file yet; they are appended to
+    the log, synced once per group of statements, before the pins
+    are released. The statement is only durable once its group is
+    synced, see db_sync()
+*/
+void pager_commit(Pager* pager) {
+
+    wal_log_pending(pager);
+    pager_unpin_all(pager);
+
+    if (pager->wal_enabled && pager->wal_records >= WAL_CHECKPOINT_RECORDS) {
+        wal_checkpoint(pager);
+    }
+
+}
+
+/* 
+    Function to allocate a new page to the nodes. Pages freed by
+    deletes are reused first, from the free list in the header
+    page; otherwise the page is allocated at the end of the file.
+*/
+uint32_t get_unused_page_num(Pager* pager) {
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t page_num = *db_header_free_page(header);
+
+    if (page_num == DB_HEADER_PAGE_NUM) {
+        return pager->num_pages;
+    }
+
+    *db_header_free_page(header) = *free_page_next(get_page(pager, page_num));
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+    return page_num;
+
+}
+
+/*
+    Function to put a page which is no longer part of a tree on
+    the free list
+*/
+void free_page(Pager* pager, uint32_t page_num) {
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    void* page = get_page(pager, page_num);
+
+    memset(page, 0, PAGE_SIZE);
+    set_node_type(page, NODE_FREE);
+    *free_page_next(page) = *db_header_free_page(header);
+    *db_header_free_page(header) = page_num;
+
+    mark_page_dirty(pager, page_num);
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+}
+
+/*
+    Function to get the maximum node key value in LEAF as well
+    INTERNAL nodes. The right child of an internal node has no
+    separator key, so the maximum is found in the rightmost leaf
+*/
+uint32_t get_max_node_key(Pager* pager, void* node) {
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = get_page(pager, *internal_node_right_child(node));
+    }
+
+    return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+
+}
+
+/*
+    Function to point a node at a new parent. The node is not pinned,
+    since nothing else of it is needed, so moving every child of a
+    split internal node does not fill the buffer pool
+*/
+void set_node_parent(Pager* pager, uint32_t page_num, uint32_t parent_page_num) {
+
+    *node_parent(get_page_unpinned(pager, page_num)) = parent_page_num;
+    mark_page_dirty(pager, page_num);
+
+}
+
+/*
+    Function to allocate new page to store the left child
+*/
+void create_new_root(Table* table, uint32_t right_child_page_num) {
+
+    /*
+        Handle splitting the root.
+        Copying the old root to the left child (to new page).
+        Address of right child passed in.
+        Re-initialize root page to contain the new root node.
+        New root node points to the two childs.
+    */
+
+    void* root = get_page(table->pager, table->root_page_num);
+    void* right_child = get_page(table->pager, right_child_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(table->pager);
+    void* left_child = get_page(table->pager, left_child_page_num);
+
+    // Left child has data copied from the old root
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+
+    // Children of a split internal root now live under the left child
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+
+        for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+            set_node_parent(table->pager, *internal_node_child(left_child, i),
+                            left_child_page_num);
+        }
+
+    }
+
+    // Set the root as new internal node with two children
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_child(root, 0) = left_child_page_num;
+    uint32_t left_child_max_key = get_max_node_key(table->pager, left_child);
+    *internal_node_key(root, 0) = left_child_max_key;
+    *internal_node_right_child(root) = right_child_page_num;
+    *node_parent(left_child) = table->root_page_num;
+    *node_parent(right_child) = table->root_page_num;
+
+    mark_page_dirty(table->pager, table->root_page_num);
+    mark_page_dirty(table->pager, left_child_page_num);
+    mark_page_dirty(table->pager, right_child_page_num);
+ 
+}
+
+/*
+    Function to update the separator key of a child which lost
+    its upper half in a split. The child is located by a key it
+    still holds, its new maximum. The right child has no separator
+    key, so there is nothing to update for it
+*/
+void update_internal_node_key(void* node, uint32_t new_key) {
+
+    uint32_t child_index = internal_node_find_child(node, new_key);
+
+    if (child_index < *internal_node_num_keys(node)) {
+        *internal_node_key(node, child_index) = new_key;
+    }
+
+}
+
+void internal_node_insert(Table* table, uint32_t parent_page_num,
+                          uint32_t child_page_num);
+
+/*
+    Function to check whether a node is the rightmost one of its
+    level, i.e. it is reached from the root by right children only
+*/
+bool node_is_rightmost(Pager* pager, uint32_t page_num) {
+
+    void* node = get_page(pager, page_num);
+
+    while (!is_node_root(node)) {
+
+        uint32_t parent_page_num = *node_parent(node);
+        void* parent = get_page(pager, parent_page_num);
+
+        if (*internal_node_right_child(parent) != page_num) {
+            return false;
+        }
+
+        page_num = parent_page_num;
+        node = parent;
+
+    }
+
+    return true;
+
+}
+
+/*
+    Function for inserting a child into a full internal node.
+    All existing children plus the new one are divided evenly
+    between the old (left) node and a new (right) node, then the
+    new node is inserted into the parent, or a new root is created
+*/
+void internal_node_split_and_insert(Table* table, uint32_t old_page_num,
+                                    uint32_t child_page_num) {
+
+    Pager* pager = table->pager;
+    void* old_node = get_page(pager, old_page_num);
+    void* child = get_page(pager, child_page_num);
+    uint32_t child_max_key = get_max_node_key(pager, child);
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    initialize_internal_node(new_node);
+
+    /*
+        Collect every child with its maximum key in key order,
+        with the new child in its sorted position. The right
+        child's maximum is looked up in its subtree.
+    */
+
+    uint32_t num_keys = *internal_node_num_keys(old_node);
+    uint32_t right_child_page_num = *internal_node_right_child(old_node);
+    uint32_t right_child_max_key = 
+        get_max_node_key(pager, get_page(pager, right_child_page_num));
+    uint32_t insert_index = internal_node_find_child(old_node, child_max_key);
+
+    if (child_max_key > right_child_max_key) {
+        insert_index = num_keys + 1;
+    }
+
+    uint32_t total = num_keys + 2;
+    uint32_t children[total];
+    uint32_t keys[total];
+
+    for (uint32_t i = 0, j = 0; j < total; j++) {
+
+        if (j == insert_index) {
+
+            children[j] = child_page_num;
+            keys[j] = child_max_key;
+
+        }
+        else {
+
+            children[j] = *internal_node_child(old_node, i);
+            keys[j] = (i < num_keys) ? *internal_node_key(old_node, i)
+                                     : right_child_max_key;
+            i++;
+
+        }
+
+    }
+
+    /*
+        The last child of each half becomes its right child and
+        drops its separator key
+    */
+
+    uint32_t left_count = total / 2;
+
+    /*
+        A child appended past the end of the rightmost node comes
+        from ascending inserts; keep the old node full and start
+        the new node with just that child
+    */
+    if (insert_index == total - 1 && node_is_rightmost(pager, old_page_num)) {
+        left_count = total - 1;
+    }
+
+    uint32_t right_count = total - left_count;
+
+    *internal_node_num_keys(old_node) = left_count - 1;
+    for (uint32_t i = 0; i < left_count - 1; i++) {
+
+        *internal_node_cell(old_node, i) = children[i];
+        *internal_node_key(old_node, i) = keys[i];
+
+    }
+    *internal_node_right_child(old_node) = children[left_count - 1];
+
+    *internal_node_num_keys(new_node) = right_count - 1;
+    for (uint32_t i = 0; i < right_count - 1; i++) {
+
+        *internal_node_cell(new_node, i) = children[left_count + i];
+        *internal_node_key(new_node, i) = keys[left_count + i];
+
+    }
+    *internal_node_right_child(new_node) = children[total - 1];
+
+    // Moved children point at their new parent
+    for (uint32_t i = left_count; i < total; i++) {
+        set_node_parent(pager, children[i], new_page_num);
+    }
+
+    if (insert_index < left_count) {
+
+        *node_parent(child) = old_page_num;
+        mark_page_dirty(pager, child_page_num);
+
+    }
+
+    mark_page_dirty(pager, old_page_num);
+    mark_page_dirty(pager, new_page_num);
+
+    if (is_node_root(old_node)) {
+        return create_new_root(table, new_page_num);
+    }
+    else {
+
+        uint32_t parent_page_num = *node_parent(old_node);
+        void* parent = get_page(pager, parent_page_num);
+
+        update_internal_node_key(parent, keys[left_count - 1]);
+        mark_page_dirty(pager, parent_page_num);
+        internal_node_insert(table, parent_page_num, new_page_num);
+
+    }
+
+}
+
+/*
+    Function to add a new child/key pair to the parent that
+    corresponds to the child
+*/
+void internal_node_insert(Table* table, uint32_t parent_page_num,
+                          uint32_t child_page_num) {
+
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    void* child = get_page(pager, child_page_num);
+    uint32_t child_max_key = get_max_node_key(pager, child);
+    uint32_t index = internal_node_find_child(parent, child_max_key);
+
+    uint32_t original_num_keys = *internal_node_num_keys(parent);
+
+    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
+
+        // Node is full
+        internal_node_split_and_insert(table, parent_page_num, 
+                                       child_page_num);
+        return;
+
+    }
+
+    *node_parent(child) = parent_page_num;
+    mark_page_dirty(pager, child_page_num);
+    mark_page_dirty(pager, parent_page_num);
+
+    uint32_t right_child_page_num = *internal_node_right_child(parent);
+    void* right_child = get_page(pager, right_child_page_num);
+    uint32_t right_child_max_key = get_max_node_key(pager, right_child);
+
+    *internal_node_num_keys(parent) = original_num_keys + 1;
+
+    if (child_max_key > right_child_max_key) {
+
+        // Replace the right child
+        *internal_node_child(parent, original_num_keys) = right_child_page_num;
+        *internal_node_key(parent, original_num_keys) = right_child_max_key;
+        *internal_node_right_child(parent) = child_page_num;
+
+    }
+    else {
+
+        // Make room for the new cell in both arrays
+        memmove(internal_node_cell(parent, index + 1),
+                internal_node_cell(parent, index),
+                (original_num_keys - index) * INTERNAL_NODE_CHILD_SIZE);
+        memmove(internal_node_key(parent, index + 1),
+                internal_node_key(parent, index),
+                (original_num_keys - index) * INTERNAL_NODE_KEY_SIZE);
+
+        *internal_node_child(parent, index) = child_page_num;
+        *internal_node_key(parent, index) = child_max_key;
+
+    }
+
+}
+
+/*
+    Function to divide the cells of a full leaf, plus a new cell at
+    `cell_num`, between the leaf and an empty new leaf. Both leaves
+    are rebuilt from a copy of the old one, which also compacts the
+    payloads. Cell i of the combined sequence is the new cell at
+    `cell_num`, or an old cell shifted by one.
+*/
+void leaf_node_split_cells(void* old_node, void* new_node, uint32_t cell_num,
+                           uint32_t key, void* payload, 
+                           uint32_t payload_length, bool rightmost) {
+
+    uint8_t scratch[PAGE_SIZE];
+    uint32_t old_num_cells = *leaf_node_num_cells(old_node);
+    uint32_t total_cells = old_num_cells + 1;
+
+    memcpy(scratch, old_node, PAGE_SIZE);
+
+    /*
+        Cells are divided so that both leaves hold about the same
+        number of bytes. A key appended to the rightmost leaf comes 
+        from ascending inserts, so the old leaf stays full and the
+        new leaf starts with only the new key.
+    */
+
+    uint32_t left_split_count = total_cells - 1;
+
+    if (cell_num != old_num_cells || !rightmost) {
+
+        uint32_t total_bytes = total_cells * LEAF_NODE_SLOT_SIZE + payload_length;
+        uint32_t left_bytes = 0;
+
+        for (uint32_t i = 0; i < old_num_cells; i++) {
+            total_bytes += *leaf_node_cell_length(scratch, i);
+        }
+
+        for (left_split_count = 0; left_split_count < total_cells - 1; 
+             left_split_count++) {
+
+            uint32_t i = left_split_count;
+            uint32_t length = payload_length;
+
+            if (i != cell_num) {
+                length = *leaf_node_cell_length(scratch, 
+                                                i > cell_num ? i - 1 : i);
+            }
+
+            if (left_bytes > 0 && 2 * left_bytes + length > total_bytes) {
+                break;
+            }
+
+            left_bytes += LEAF_NODE_SLOT_SIZE + length;
+
+        }
+
+    }
+
+    *leaf_node_num_cells(old_node) = 0;
+    *leaf_node_content_start(old_node) = PAGE_SIZE;
+
+    for (uint32_t i = 0; i < total_cells; i++) {
+
+        void* destination_node = i < left_split_count ? old_node : new_node;
+
+        if (i == cell_num) {
+            leaf_node_append_cell(destination_node, key, payload, payload_length);
+        }
+        else {
+
+            uint32_t old_cell = i > cell_num ? i - 1 : i;
+
+            leaf_node_append_cell(destination_node, 
+                                  *leaf_node_key(scratch, old_cell),
+                                  leaf_node_value(scratch, old_cell),
+                                  *leaf_node_cell_length(scratch, old_cell));
+
+        }
+
+    }
+
+}
+
+/*
+    Function for inserying a key-value pair into a leaf node
+    in case of a full node
+*/
+void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+
+    /*
+        Create a new node and move half the cells over. Insert the 
+        new value in one of the two nodes. Update the parent or
+        create a new parent.
+    */
+
+   void* old_node = get_page(cursor->table->pager, cursor->page_num);
+   uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
+   void* new_node = get_page(cursor->table->pager, new_page_num);
+   initialize_leaf_node(new_node);
+   *node_parent(new_node) = *node_parent(old_node);
+   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+   *leaf_node_next_leaf(old_node) = new_page_num;
+
+    uint8_t payload[ROW_MAX_SIZE];
+    uint32_t payload_length = serialize_row(value, payload);
+
+    leaf_node_split_cells(old_node, new_node, cursor->cell_num, key, 
+                          payload, payload_length,
+                          *leaf_node_next_leaf(new_node) == INVALID_PAGE_NUM);
+
+    mark_page_dirty(cursor->table->pager, cursor->page_num);
+    mark_page_dirty(cursor->table->pager, new_page_num);
+
+    if (is_node_root(old_node)) {
+        return create_new_root(cursor->table, new_page_num);
+    }   
+    else {
+
+        uint32_t parent_page_num = *node_parent(old_node);
+        uint32_t new_max = get_max_node_key(cursor->table->pager, old_node);
+        void* parent = get_page(cursor->table->pager, parent_page_num);
+
+        update_internal_node_key(parent, new_max);
+        mark_page_dirty(cursor->table->pager, parent_page_num);
+        internal_node_insert(cursor->table, parent_page_num, new_page_num);
+
+    }
+
+}
+
+/*
+    Function for inserting a key-value pair into a leaf node. Only
+    the slots after the insert position move; the payload goes in
+    front of the others at the end of the page
+*/
+void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
+
+    void* node = get_page(cursor->table->pager,cursor->page_num);
+    uint32_t length = serialized_row_size(value);
+
+    if (!leaf_node_has_room(node, length)) {
+
+        // Node is full
+        leaf_node_split_and_insert(cursor, key, value);
+        return;
+
+    }
+
+    uint8_t payload[ROW_MAX_SIZE];
+
+    serialize_row(value, payload);
+    leaf_node_insert_cell(node, cursor->cell_num, key, payload, length);
+    mark_page_dirty(cursor->table->pager, cursor->page_num);
+
+}
+
+/* Deletes are performed by the following functions
+    - Remove a cell from a leaf and keep the separators exact
+    - Merge an underfull node with a sibling, or borrow from it
+    - Shrink the tree when the root is left with a single child
+    Pages emptied by merges go on the free list.
+*/
+
+/*
+    Function to find the position of a child in its parent, the 
+    number of keys for the right child
+*/
+uint32_t internal_node_child_index(void* node, uint32_t child_page_num) {
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+        if (*internal_node_cell(node, i) == child_page_num) {
+            return i;
+        }
+    }
+
+    return num_keys;
+
+}
+
+/*
+    Function to remove cell `index` of an internal node, after the
+    child which follows it has taken over its keys
+*/
+void internal_node_remove_cell(void* node, uint32_t index) {
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    memmove(internal_node_cell(node, index),
+            internal_node_cell(node, index + 1),
+            (num_keys - index - 1) * INTERNAL_NODE_CHILD_SIZE);
+    memmove(internal_node_key(node, index),
+            internal_node_key(node, index + 1),
+            (num_keys - index - 1) * INTERNAL_NODE_KEY_SIZE);
+
+    *internal_node_num_keys(node) = num_keys - 1;
+
+}
+
+/*
+    Function to bring the separators above a node back to its 
+    maximum key. Walks up while the node is a right child, since 
+    the maximum of its parent changes with it
+*/
+void update_max_key(Table* table, uint32_t page_num) {
+
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+
+    while (!is_node_root(node)) {
+
+        uint32_t max_key = get_max_node_key(pager, node);
+        uint32_t parent_page_num = *node_parent(node);
+        void* parent = get_page(pager, parent_page_num);
+        uint32_t index = internal_node_child_index(parent, page_num);
+
+        if (index < *internal_node_num_keys(parent)) {
+
+            *internal_node_key(parent, index) = max_key;
+            mark_page_dirty(pager, parent_page_num);
+            return;
+
+        }
+
+        page_num = parent_page_num;
+        node = parent;
+
+    }
+
+}
+
+/*
+    Function to replace the root by its only child, which happens
+    when a merge leaves the root without keys. The child is copied
+    into the root page so the root page number never changes.
+*/
+void collapse_root(Table* table) {
+
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+    uint32_t child_page_num = *internal_node_right_child(root);
+    void* child = get_page(pager, child_page_num);
+
+    memcpy(root, child, PAGE_SIZE);
+    set_node_root(root, true);
+    mark_page_dirty(pager, table->root_page_num);
+
+    if (get_node_type(root) == NODE_INTERNAL) {
+
+        for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+            set_node_parent(pager, *internal_node_child(root, i), 
+                            table->root_page_num);
+        }
+
+    }
+
+    free_page(pager, child_page_num);
+
+}
+
+/*
+    Function to pick the sibling an underfull node is rebalanced
+    with: its left neighbour if it has one, otherwise its right 
+    neighbour. Returns the index of the left node of the pair
+*/
+uint32_t sibling_pair(void* parent, uint32_t page_num, 
+                      uint32_t* left_page_num, uint32_t* right_page_num) {
+
+    uint32_t index = internal_node_child_index(parent, page_num);
+
+    if (index > 0) {
+        index -= 1;
+    }
+
+    *left_page_num = *internal_node_child(parent, index);
+    *right_page_num = *internal_node_child(parent, index + 1);
+
+    return index;
+
+}
+
+/*
+    Function to drop the right node of a merged pair from the
+    parent and free it. The parent entry of the right node now
+    points at the left node, which holds both their keys.
+*/
+void remove_merged_node(Table* table, uint32_t parent_page_num, uint32_t index,
+                        uint32_t left_page_num, uint32_t right_page_num) {
+
+    void* parent = get_page(table->pager, parent_page_num);
+
+    *internal_node_child(parent, index + 1) = left_page_num;
+    internal_node_remove_cell(parent, index);
+    mark_page_dirty(table->pager, parent_page_num);
+
+    free_page(table->pager, right_page_num);
+
+}
+
+void internal_node_rebalance(Table* table, uint32_t page_num);
+
+/*
+    Function to return the parent of an underfull node, making sure
+    it has another child to rebalance with. An append split leaves
+    the new node with a single child; such a parent is rebalanced
+    first, which may move the node under another parent. The root
+    always has a key here, as it is collapsed as soon as it has none.
+*/
+uint32_t parent_with_sibling(Table* table, void* node) {
+
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(table->pager, parent_page_num);
+
+    if (*internal_node_num_keys(parent) == 0) {
+        internal_node_rebalance(table, parent_page_num);
+    }
+
+    return *node_parent(node);
+
+}
+
+/*
+    Function to rebalance a leaf which fell under LEAF_NODE_MIN_FILL.
+    If the leaf and its sibling fit in one page they are merged,
+    otherwise their cells are divided evenly by bytes.
+*/
+void leaf_node_rebalance(Table* table, uint32_t page_num) {
+
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    uint32_t parent_page_num = parent_with_sibling(table, node);
+    void* parent = get_page(pager, parent_page_num);
+
+    uint32_t left_page_num, right_page_num;
+    uint32_t index = sibling_pair(parent, page_num, &left_page_num, &right_page_num);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+    uint32_t left_num_cells = *leaf_node_num_cells(left);
+    uint32_t right_num_cells = *leaf_node_num_cells(right);
+    uint32_t total_cells = left_num_cells + right_num_cells;
+    uint32_t total_bytes = leaf_node_used_space(left) + leaf_node_used_space(right);
+
+    // Both leaves are rebuilt from copies, which also compacts them
+    uint8_t left_scratch[PAGE_SIZE];
+    uint8_t right_scratch[PAGE_SIZE];
+
+    memcpy(left_scratch, left, PAGE_SIZE);
+    memcpy(right_scratch, right, PAGE_SIZE);
+
+    uint32_t left_count = total_cells;
+
+    if (total_bytes > LEAF_NODE_SPACE_FOR_CELLS) {
+
+        uint32_t left_bytes = 0;
+
+        for (left_count = 0; left_count < total_cells - 1; left_count++) {
+
+            void* source = (left_count < left_num_cells) ? left_scratch : right_scratch;
+            uint32_t cell = (left_count < left_num_cells) ? left_count 
+                                                          : left_count - left_num_cells;
+            uint32_t length = LEAF_NODE_SLOT_SIZE + *leaf_node_cell_length(source, cell);
+
+            if (left_bytes > 0 && 2 * left_bytes + length > total_bytes) {
+                break;
+            }
+
+            left_bytes += length;
+
+        }
+
+    }
+
+    *leaf_node_num_cells(left) = 0;
+    *leaf_node_content_start(left) = PAGE_SIZE;
+    *leaf_node_num_cells(right) = 0;
+    *leaf_node_content_start(right) = PAGE_SIZE;
+
+    for (uint32_t i = 0; i < total_cells; i++) {
+
+        void* source = (i < left_num_cells) ? left_scratch : right_scratch;
+        uint32_t cell = (i < left_num_cells) ? i : i - left_num_cells;
+
+        leaf_node_append_cell((i < left_count) ? left : right,
+                              *leaf_node_key(source, cell),
+                              leaf_node_value(source, cell),
+                              *leaf_node_cell_length(source, cell));
+
+    }
+
+    mark_page_dirty(pager, left_page_num);
+    mark_page_dirty(pager, right_page_num);
+
+    if (left_count < total_cells) {
+
+        // Borrowed: only the separator of the left leaf moved
+        *internal_node_key(parent, index) = *leaf_node_key(left, left_count - 1);
+        mark_page_dirty(pager, parent_page_num);
+        return;
+
+    }
+
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+
+    remove_merged_node(table, parent_page_num, index, left_page_num, right_page_num);
+    update_max_key(table, left_page_num);
+    internal_node_rebalance(table, parent_page_num);
+
+}
+
+/*
+    Function to rebalance an internal node which fell under 
+    INTERNAL_NODE_MIN_KEYS, the same way as leaves: merge with a 
+    sibling when the keys fit, otherwise divide the children
+    evenly. The separator between the two nodes moves down into 
+    the keys, as the maximum key of the left node's right child.
+*/
+void internal_node_rebalance(Table* table, uint32_t page_num) {
+
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+
+    if (is_node_root(node)) {
+
+        if (*internal_node_num_keys(node) == 0) {
+            collapse_root(table);
+        }
+        return;
+
+    }
+
+    if (*internal_node_num_keys(node) >= INTERNAL_NODE_MIN_KEYS) {
+        return;
+    }
+
+    uint32_t parent_page_num = parent_with_sibling(table, node);
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t left_page_num, right_page_num;
+    uint32_t index = sibling_pair(parent, page_num, &left_page_num, &right_page_num);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+    uint32_t left_num_keys = *internal_node_num_keys(left);
+    uint32_t right_num_keys = *internal_node_num_keys(right);
+
+    uint32_t total = left_num_keys + right_num_keys + 2;
+    uint32_t children[total];
+    uint32_t keys[total];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i <= left_num_keys; i++, count++) {
+        children[count] = *internal_node_child(left, i);
+        keys[count] = (i < left_num_keys) ? *internal_node_key(left, i)
+                                          : *internal_node_key(parent, index);
+    }
+
+    for (uint32_t i = 0; i <= right_num_keys; i++, count++) {
+        children[count] = *internal_node_child(right, i);
+        keys[count] = (i < right_num_keys) ? *internal_node_key(right, i) : 0;
+    }
+
+    // Children of the left node after the rebuild, the last one is its right child
+    uint32_t left_count = (total - 1 <= INTERNAL_NODE_MAX_CELLS) ? total : total / 2;
+
+    *internal_node_num_keys(left) = left_count - 1;
+    for (uint32_t i = 0; i < left_count - 1; i++) {
+        *internal_node_cell(left, i) = children[i];
+        *internal_node_key(left, i) = keys[i];
+    }
+    *internal_node_right_child(left) = children[left_count - 1];
+    mark_page_dirty(pager, left_page_num);
+
+    for (uint32_t i = left_num_keys + 1; i < left_count; i++) {
+        set_node_parent(pager, children[i], left_page_num);
+    }
+
+    if (left_count == total) {
+
+        remove_merged_node(table, parent_page_num, index, 
+                           left_page_num, right_page_num);
+        internal_node_rebalance(table, parent_page_num);
+        return;
+
+    }
+
+    uint32_t right_count = total - left_count;
+
+    *internal_node_num_keys(right) = right_count - 1;
+    for (uint32_t i = 0; i < right_count - 1; i++) {
+        *internal_node_cell(right, i) = children[left_count + i];
+        *internal_node_key(right, i) = keys[left_count + i];
+    }
+    *internal_node_right_child(right) = children[total - 1];
+    mark_page_dirty(pager, right_page_num);
+
+    for (uint32_t i = left_count; i <= left_num_keys; i++) {
+        set_node_parent(pager, children[i], right_page_num);
+    }
+
+    *internal_node_key(parent, index) = keys[left_count - 1];
+    mark_page_dirty(pager, parent_page_num);
+
+}
+
+/*
+    Function to delete the row under the cursor, then rebalance
+    the leaf if it is left underfull
+*/
+void leaf_node_delete(Cursor* cursor) {
+
+    Table* table = cursor->table;
+    void* node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    leaf_node_remove_cell(node, cursor->cell_num);
+    mark_page_dirty(table->pager, cursor->page_num);
+
+    if (is_node_root(node)) {
+        return;
+    }
+
+    // The separators above still hold the deleted key
+    if (cursor->cell_num == num_cells - 1 && num_cells > 1) {
+        update_max_key(table, cursor->page_num);
+    }
+
+    if (leaf_node_used_space(node) < LEAF_NODE_MIN_FILL) {
+        leaf_node_rebalance(table, cursor->page_num);
+    }
+
+}
+
+/* Cursor functions are peroformed by the following funtions 
+    - Find the position of a key in the table
+    - Create a cursor at the beginning of the table, or at a key
+    - Access the elements of the row pointed by the cursor
+    - Advance the cursor to the next row, across leaves
+*/
+
+/*
+    Function to search for a key in the leaf node. The cursor
+    points at the key, or at the position where it should be
+    inserted if it is not present
+*/
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+
+    void* node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->end_of_table = false;
+    cursor->leaves_followed = 0;
+    cursor->latched = false;
+    cursor->depth = 0;
+    cursor->snapshot = false;
+    cursor->cell_num = node_key_lower_bound(leaf_node_key(node, 0),
+                                            LEAF_NODE_SLOT_SIZE,
+                                            num_cells, key);
+
+    return cursor;
+
+}
+
+/*
+    Return the position of the given key, like table_find(). Also
+    returns the largest key the leaf is responsible for: the
+    separator of the last left branch taken, or UINT32_MAX on the
+    rightmost path
+*/
+Cursor* table_find_bounded(Table* table, uint32_t key, uint32_t* upper_bound) {
+
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(table->pager, page_num);
+    uint32_t path_pages[TREE_MAX_DEPTH];
+    uint32_t path_children[TREE_MAX_DEPTH];
+    uint32_t depth = 0;
+
+    *upper_bound = UINT32_MAX;
+
+    // Descend from the root to the leaf which covers the key
+    while (get_node_type(node) == NODE_INTERNAL) {
+
+        uint32_t child_index = internal_node_find_child(node, key);
+
+        if (child_index < *internal_node_num_keys(node)) {
+            *upper_bound = *internal_node_key(node, child_index);
+        }
+
+        path_pages[depth] = page_num;
+        path_children[depth] = child_index;
+        depth++;
+
+        page_num = *internal_node_child(node, child_index);
+        node = get_page(table->pager, page_num);
+
+    }
+
+    Cursor* cursor = leaf_node_find(table, page_num, key);
+    cursor->depth = depth;
+    memcpy(cursor->path_pages, path_pages, depth * sizeof(uint32_t));
+    memcpy(cursor->path_children, path_children, depth * sizeof(uint32_t));
+
+    return cursor;
+
+}
+
+/*
+    Return the position of the given key
+    If the key is not present, return the position
+    where it should be inserted
+*/
+Cursor* table_find(Table* table, uint32_t key) {
+
+    uint32_t upper_bound;
+    return table_find_bounded(table, key, &upper_bound);
+
+}
+
+/*
+    Functions to take and release the tree latch
+*/
+void tree_latch_acquire(Table* table, LatchMode mode) {
+
+    pthread_mutex_lock(&table->tree_turnstile);
+
+    if (mode == LATCH_WRITE) {
+        pthread_rwlock_wrlock(&table->tree_latch);
+    }
+    else {
+        pthread_rwlock_rdlock(&table->tree_latch);
+    }
+
+    pthread_mutex_unlock(&table->tree_turnstile);
+
+}
+
+void tree_latch_release(Table* table) {
+    pthread_rwlock_unlock(&table->tree_latch);
+}
+
+/*
+    Return the position of the given key, with the leaf fixed and
+    latched in the given mode, for threads which hold the tree latch
+    shared. The descent crabs: each child is latched before its
+    parent is released. Every child is safe to release the parent
+    for, since nodes are only split or merged under the exclusive
+    tree latch, so writers only latch the leaf for writing.
+*/
+Cursor* table_find_latched(Table* table, uint32_t key, LatchMode mode) {
+
+    Pager* pager = table->pager;
+    PageHandle handle;
+    uint32_t page_num = table->root_page_num;
+    void* node = pager_fix_page(pager, page_num, LATCH_READ, &handle);
+    Cursor* cursor = malloc(sizeof(Cursor));
+
+    cursor->depth = 0;
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+
+        uint32_t child_index = internal_node_find_child(node, key);
+        PageHandle child;
+
+        cursor->path_pages[cursor->depth] = page_num;
+        cursor->path_children[cursor->depth] = child_index;
+        cursor->depth++;
+
+        page_num = *internal_node_child(node, child_index);
+        node = pager_fix_page(pager, page_num, LATCH_READ, &child);
+        pager_unfix_page(pager, &handle);
+        handle = child;
+
+    }
+
+    pager_relatch_page(&handle, mode);
+
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->end_of_table = false;
+    cursor->leaves_followed = 0;
+    cursor->latched = true;
+    cursor->leaf = handle;
+    cursor->snapshot = false;
+    cursor->cell_num = node_key_lower_bound(leaf_node_key(node, 0),
+                                            LEAF_NODE_SLOT_SIZE,
+                                            *leaf_node_num_cells(node), key);
+
+    return cursor;
+
+}
+
+/*
+    Function for a page read by a cursor. Snapshot cursors read
+    the map directly, since the pager is not thread-safe
+*/
+void* cursor_page(Cursor* cursor, uint32_t page_num) {
+
+    Pager* pager = cursor->table->pager;
+
+    if (cursor->snapshot) {
+        return pager->map + (off_t)page_num * PAGE_SIZE;
+    }
+
+    return get_page_unpinned(pager, page_num);
+
+}
+
+/*
+    Function for the leaf a cursor is on
+*/
+void* cursor_leaf(Cursor* cursor) {
+
+    if (cursor->latched) {
+        return cursor->leaf.data;
+    }
+
+    return cursor_page(cursor, cursor->page_num);
+
+}
+
+/*
+    Function for the leaf after the cursor's leaf in a copy-on-write
+    tree, found along the cursor's path: up to the nearest node with
+    a child after the one taken, then down the leftmost children of 
+    that child. Returns INVALID_PAGE_NUM after the rightmost leaf
+*/
+uint32_t cursor_next_leaf_by_path(Cursor* cursor) {
+
+    while (cursor->depth > 0) {
+
+        uint32_t level = cursor->depth - 1;
+        void* node = cursor_page(cursor, cursor->path_pages[level]);
+
+        if (cursor->path_children[level] < *internal_node_num_keys(node)) {
+
+            cursor->path_children[level] += 1;
+            uint32_t page_num = *internal_node_child(node, 
+                                                     cursor->path_children[level]);
+            node = cursor_page(cursor, page_num);
+
+            while (get_node_type(node) == NODE_INTERNAL) {
+
+                cursor->path_pages[cursor->depth] = page_num;
+                cursor->path_children[cursor->depth] = 0;
+                cursor->depth++;
+
+                page_num = *internal_node_child(node, 0);
+                node = cursor_page(cursor, page_num);
+
+            }
+
+            return page_num;
+
+        }
+
+        cursor->depth--;
+
+    }
+
+    return INVALID_PAGE_NUM;
+
+}
+
+/*
+    Function to start reading the leaves after the next one while a
+    cursor scans the table. They are the following children of the
+    leaf's parent, so no sibling pointer has to be read first.
+    Read-ahead stops at the end of the parent and is limited to a
+    quarter of the buffer pool.
+*/
+void cursor_read_ahead(Cursor* cursor, void* leaf) {
+
+    Pager* pager = cursor->table->pager;
+    uint32_t num_cells = *leaf_node_num_cells(leaf);
+
+    // Index leaves keep no parent pointers
+    if (get_node_type(leaf) != NODE_LEAF || is_node_root(leaf) || 
+        num_cells == 0) {
+        return;
+    }
+
+    uint32_t max_key = *leaf_node_key(leaf, num_cells - 1);
+    void* parent = get_page_unpinned(pager, *node_parent(leaf));
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    uint32_t child_index = internal_node_find_child(parent, max_key);
+
+    uint32_t window = READ_AHEAD_PAGES;
+    if (pager->mode == PAGER_BUFFER_POOL && window > pager->pool_size / 4) {
+        window = pager->pool_size / 4;
+    }
+
+    // Prefetching may evict the parent, so copy the children first
+    uint32_t pages[READ_AHEAD_PAGES];
+    uint32_t num_pages = 0;
+
+    for (uint32_t i = child_index + 2; 
+         i <= num_keys && num_pages < window; i++) {
+        pages[num_pages++] = *internal_node_child(parent, i);
+    }
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        pager_prefetch(pager, pages[i]);
+    }
+
+}
+
+/*
+    Function to move a cursor which is past the last cell of its
+    leaf to the first cell of the following leaf, by the sibling
+    pointers, or by its path in a copy-on-write tree. Sets 
+    end_of_table after the rightmost leaf
+*/
+void cursor_follow_next_leaf(Cursor* cursor) {
+
+    Pager* pager = cursor->table->pager;
+    void* node = cursor_leaf(cursor);
+
+    while (cursor->cell_num >= *leaf_node_num_cells(node)) {
+
+        // Index trees are never copied, so they keep their sibling pointers
+        bool by_path = cursor->table->cow.enabled && 
+                       get_node_type(node) == NODE_LEAF;
+        uint32_t next_page_num = by_path ? cursor_next_leaf_by_path(cursor)
+                                         : *leaf_node_next_leaf(node);
+
+        if (next_page_num == INVALID_PAGE_NUM) {
+            
+            cursor->end_of_table = true;
+            return;
+
+        }
+
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+
+        if (cursor->latched) {
+
+            // Latch the sibling before letting go of the leaf
+            PageHandle next;
+            node = pager_fix_page(pager, next_page_num, LATCH_READ, &next);
+            pager_unfix_page(pager, &cursor->leaf);
+            cursor->leaf = next;
+            continue;
+
+        }
+
+        // A cursor which keeps following siblings is scanning
+        cursor->leaves_followed += 1;
+        if (!by_path && cursor->leaves_followed >= READ_AHEAD_TRIGGER) {
+            cursor_read_ahead(cursor, node);
+        }
+
+        node = cursor_page(cursor, next_page_num);
+
+    }
+
+}
+
+/*
+    Return a cursor at the first row with a key >= the given key,
+    e.g. the start of a range scan
+*/
+Cursor* table_seek(Table* table, uint32_t key) {
+
+    Cursor* cursor = table_find(table, key);
+    cursor_follow_next_leaf(cursor);
+
+    return cursor;
+
+}
+
+/*
+    Return a cursor at the first row of the leftmost leaf
+*/
+Cursor* table_start(Table* table) {
+    return table_seek(table, 0);
+}
+
+/*
+    Function for the key of the row described by the cursor
+*/
+uint32_t cursor_key(Cursor* cursor) {
+
+    void* page = cursor_leaf(cursor);
+
+    return *leaf_node_key(page, cursor->cell_num);
+
+}
+
+/* 
+    Function for pointing the position described by the cursor
+*/
+void* cursor_value(Cursor* cursor) {
+
+    void* page = cursor_leaf(cursor);
+
+    return leaf_node_value(page, cursor->cell_num);
+
+}
+
+/*
+    Function to advance the cursor to the next row in the table
+*/
+void cursor_advance(Cursor* cursor) {
+
+    cursor->cell_num += 1;
+    cursor_follow_next_leaf(cursor);
+
+}
+
+/* Copy-on-write mode is handled by the following functions
+    - Copy a page of the table tree before it is changed
+    - Publish the changed tree and free the pages no snapshot reads
+    - Insert and delete rows by copying the path from the root
+    - Open snapshots, which walk a published tree without latches
+
+    A statement never changes a page of the published tree. The 
+    pages it changes, and the pages on their paths up to the root,
+    are written to new pages, and at the end of the statement the
+    new root is published in the header with the next epoch. A
+    snapshot pins the epoch it reads, and a page replaced in an 
+    epoch is freed once no snapshot pins that epoch or an older 
+    one. The nodes keep no parent or sibling pointers, which would
+    have to be copied as well, and are not merged on deletes. The
+    secondary indexes are not part of snapshots and are still 
+    changed in place.
+*/
+
+/*
+    Function to record that a page is written in the current
+    epoch, so it is changed in place until the tree is published
+*/
+void cow_mark_written(Table* table, uint32_t page_num) {
+
+    CopyOnWrite* cow = &table->cow;
+
+    if (page_num >= cow->page_epochs_capacity) {
+
+        uint32_t capacity = cow->page_epochs_capacity;
+        while (capacity <= page_num) {
+            capacity *= 2;
+        }
+
+        cow->page_epochs = realloc(cow->page_epochs, capacity * sizeof(uint32_t));
+        memset(cow->page_epochs + cow->page_epochs_capacity, 0,
+               (capacity - cow->page_epochs_capacity) * sizeof(uint32_t));
+        cow->page_epochs_capacity = capacity;
+
+    }
+
+    cow->page_epochs[page_num] = cow->epoch + 1;
+    cow->changed = true;
+
+}
+
+/*
+    Function to allocate a page for a node of the next epoch
+*/
+uint32_t cow_new_page(Table* table) {
+
+    uint32_t page_num = get_unused_page_num(table->pager);
+
+    get_page(table->pager, page_num);
+    cow_mark_written(table, page_num);
+
+    return page_num;
+
+}
+
+/*
+    Function to retire a page of the published tree which the next
+    epoch no longer uses, to be freed once no snapshot reads it
+*/
+void cow_retire(Table* table, uint32_t page_num) {
+
+    CopyOnWrite* cow = &table->cow;
+
+    if (cow->num_retired == cow->retired_capacity) {
+
+        cow->retired_capacity *= 2;
+        cow->retired = realloc(cow->retired, 
+                               cow->retired_capacity * sizeof(RetiredPage));
+
+    }
+
+    cow->retired[cow->num_retired].page_num = page_num;
+    cow->retired[cow->num_retired].epoch = cow->epoch;
+    cow->num_retired += 1;
+
+}
+
+/*
+    Function to get a node of the table tree ready to be changed.
+    A node of the published tree is copied to a new page, which
+    is returned, and the old page is retired; the parent of the
+    node has to be pointed at the copy
+*/
+uint32_t cow_page(Table* table, uint32_t page_num) {
+
+    CopyOnWrite* cow = &table->cow;
+    Pager* pager = table->pager;
+
+    if (page_num < cow->page_epochs_capacity && 
+        cow->page_epochs[page_num] == cow->epoch + 1) {
+        return page_num;
+    }
+
+    uint32_t new_page_num = cow_new_page(table);
+    memcpy(get_page(pager, new_page_num), get_page(pager, page_num), PAGE_SIZE);
+    mark_page_dirty(pager, new_page_num);
+    cow_retire(table, page_num);
+
+    return new_page_num;
+
+}
+
+/*
+    Function to free the retired pages no snapshot reads any more:
+    the pages retired before the oldest epoch still pinned
+*/
+void cow_reclaim(Table* table) {
+
+    CopyOnWrite* cow = &table->cow;
+    uint32_t oldest_epoch = cow->epoch;
+    uint32_t num_kept = 0;
+
+    for (uint32_t slot = 0; slot < SNAPSHOT_MAX_READERS; slot++) {
+
+        uint32_t epoch = __atomic_load_n(&cow->readers[slot], __ATOMIC_SEQ_CST);
+
+        if (epoch != 0 && epoch < oldest_epoch) {
+            oldest_epoch = epoch;
+        }
+
+    }
+
+    for (uint32_t i = 0; i < cow->num_retired; i++) {
+
+        if (cow->retired[i].epoch < oldest_epoch) {
+            free_page(table->pager, cow->retired[i].page_num);
+        }
+        else {
+            cow->retired[num_kept++] = cow->retired[i];
+        }
+
+    }
+
+    cow->num_retired = num_kept;
+
+}
+
+/*
+    Function to publish the tree changed by a statement. The root
+    and the epoch are stored together in one atomic write, so a
+    snapshot reads either the whole new tree or the old one
+*/
+void cow_publish(Table* table) {
+
+    CopyOnWrite* cow = &table->cow;
+    Pager* pager = table->pager;
+
+    if (!cow->enabled || !cow->changed) {
+        return;
+    }
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+
+    cow->epoch += 1;
+    cow->changed = false;
+
+    *db_header_root_page(header) = table->root_page_num;
+    __atomic_store_n(db_header_snapshot(header),
+                     ((uint64_t)cow->epoch << 32) | table->root_page_num,
+                     __ATOMIC_SEQ_CST);
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+    cow_reclaim(table);
+
+}
+
+/*
+    Function to check whether a db file was written in copy-on-write
+    mode, before it is opened. A file once written in it keeps it,
+    since its nodes no longer have valid parent and sibling pointers
+*/
+bool db_file_copy_on_write(const char* filename) {
+
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    void* header = malloc(PAGE_SIZE);
+    bool copy_on_write = 
+        pread(fd, header, PAGE_SIZE, (off_t)DB_HEADER_PAGE_NUM * PAGE_SIZE) == PAGE_SIZE &&
+        *db_header_magic(header) == DB_MAGIC &&
+        (*db_header_flags(header) & DB_FLAG_COPY_ON_WRITE);
+
+    free(header);
+    close(fd);
+
+    return copy_on_write;
+
+}
+
+/*
+    Function to set up copy-on-write mode for a db file which is
+    being opened, on the memory-mapped pager
+*/
+void cow_open(Table* table, bool copy_on_write) {
+
+    CopyOnWrite* cow = &table->cow;
+    Pager* pager = table->pager;
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+
+    memset(cow, 0, sizeof(CopyOnWrite));
+    cow->enabled = copy_on_write;
+
+    if (!cow->enabled) {
+        return;
+    }
+
+    if (!(*db_header_flags(header) & DB_FLAG_COPY_ON_WRITE)) {
+
+        *db_header_flags(header) |= DB_FLAG_COPY_ON_WRITE;
+        *db_header_snapshot(header) = (1ULL << 32) | table->root_page_num;
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+    }
+
+    uint64_t snapshot = *db_header_snapshot(header);
+    cow->epoch = snapshot >> 32;
+    table->root_page_num = (uint32_t)snapshot;
+
+    cow->page_epochs_capacity = 1024;
+    cow->page_epochs = calloc(cow->page_epochs_capacity, sizeof(uint32_t));
+    cow->retired_capacity = 64;
+    cow->retired = malloc(cow->retired_capacity * sizeof(RetiredPage));
+
+}
+
+/*
+    Function to free the pages still retired when the db is closed,
+    when no snapshot can be open
+*/
+void cow_close(Table* table) {
+
+    CopyOnWrite* cow = &table->cow;
+
+    if (!cow->enabled) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < cow->num_retired; i++) {
+        free_page(table->pager, cow->retired[i].page_num);
+    }
+
+    free(cow->page_epochs);
+    free(cow->retired);
+
+}
+
+/*
+    Function to write the keys and children of an internal node
+    from arrays, the last child being the right child
+*/
+void internal_node_fill(void* node, uint32_t* keys, uint32_t* children,
+                        uint32_t num_keys) {
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+
+        *internal_node_key(node, i) = keys[i];
+        *internal_node_cell(node, i) = children[i];
+
+    }
+
+    *internal_node_num_keys(node) = num_keys;
+    *internal_node_right_child(node) = children[num_keys];
+
+}
+
+/*
+    Function to add a child to a copied internal node, whose child
+    at `index` was split into `left`, with the largest key `left_max`,
+    and `right`. A full node is split as well: the new right half 
+    is returned, with the largest key of the left half in `split_max`,
+    otherwise INVALID_PAGE_NUM
+*/
+uint32_t cow_internal_node_insert(Table* table, uint32_t page_num, 
+                                  uint32_t index, uint32_t left, 
+                                  uint32_t left_max, uint32_t right,
+                                  uint32_t* split_max) {
+
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t keys[INTERNAL_NODE_MAX_CELLS + 1];
+    uint32_t children[INTERNAL_NODE_MAX_CELLS + 2];
+
+    for (uint32_t i = 0; i < index; i++) {
+
+        keys[i] = *internal_node_key(node, i);
+        children[i] = *internal_node_cell(node, i);
+
+    }
+
+    keys[index] = left_max;
+    children[index] = left;
+    children[index + 1] = right;
+
+    for (uint32_t i = index; i < num_keys; i++) {
+
+        keys[i + 1] = *internal_node_key(node, i);
+        children[i + 2] = *internal_node_child(node, i + 1);
+
+    }
+
+    num_keys += 1;
+
+    if (num_keys <= INTERNAL_NODE_MAX_CELLS) {
+
+        internal_node_fill(node, keys, children, num_keys);
+        return INVALID_PAGE_NUM;
+
+    }
+
+    // The key in the middle separates the halves and moves up
+    uint32_t split = num_keys / 2;
+    uint32_t right_page_num = cow_new_page(table);
+    void* right_node = get_page(pager, right_page_num);
+
+    initialize_internal_node(right_node);
+    internal_node_fill(node, keys, children, split);
+    internal_node_fill(right_node, keys + split + 1, children + split + 1,
+                       num_keys - split - 1);
+    mark_page_dirty(pager, right_page_num);
+
+    *split_max = keys[split];
+
+    return right_page_num;
+
+}
+
+/*
+    Function to insert a row into a copy-on-write tree. The leaf
+    is copied and split like in place, and the path above it is
+    copied up to the root, splitting full nodes on the way
+*/
+ExecuteResult cow_insert(Table* table, Row* row) {
+
+    Pager* pager = table->pager;
+    Cursor* cursor = table_find(table, row->id);
+    void* node = get_page(pager, cursor->page_num);
+
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == row->id) {
+
+        free(cursor);
+        return EXECUTE_DUPLICATE_KEY;
+
+    }
+
+    // The rightmost leaf is kept full when it splits, like in place
+    bool rightmost = true;
+    for (uint32_t level = 0; level < cursor->depth; level++) {
+
+        void* parent = get_page(pager, cursor->path_pages[level]);
+        rightmost = rightmost && 
+                    cursor->path_children[level] == *internal_node_num_keys(parent);
+
+    }
+
+    uint8_t payload[ROW_MAX_SIZE];
+    uint32_t payload_length = serialize_row(row, payload);
+    uint32_t page_num = cow_page(table, cursor->page_num);
+    uint32_t right_page_num = INVALID_PAGE_NUM;
+    uint32_t left_max = 0;
+
+    node = get_page(pager, page_num);
+
+    if (leaf_node_has_room(node, payload_length)) {
+        leaf_node_insert_cell(node, cursor->cell_num, row->id, 
+                              payload, payload_length);
+    }
+    else {
+
+        right_page_num = cow_new_page(table);
+        void* right_node = get_page(pager, right_page_num);
+
+        initialize_leaf_node(right_node);
+        leaf_node_split_cells(node, right_node, cursor->cell_num, row->id,
+                              payload, payload_length, rightmost);
+        left_max = *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+        mark_page_dirty(pager, right_page_num);
+
+    }
+
+    mark_page_dirty(pager, page_num);
+
+    // Point the copied parents at the copies, adding the split halves
+    for (uint32_t level = cursor->depth; level > 0; level--) {
+
+        uint32_t parent_page_num = cow_page(table, cursor->path_pages[level - 1]);
+        uint32_t index = cursor->path_children[level - 1];
+
+        if (right_page_num == INVALID_PAGE_NUM) {
+            *internal_node_child(get_page(pager, parent_page_num), index) = page_num;
+        }
+        else {
+            right_page_num = cow_internal_node_insert(table, parent_page_num, 
+                                                      index, page_num, left_max,
+                                                      right_page_num, &left_max);
+        }
+
+        mark_page_dirty(pager, parent_page_num);
+        page_num = parent_page_num;
+
+    }
+
+    // A split root gets a new root above its halves
+    if (right_page_num != INVALID_PAGE_NUM) {
+
+        uint32_t root_page_num = cow_new_page(table);
+        void* root = get_page(pager, root_page_num);
+
+        initialize_internal_node(root);
+        set_node_root(root, true);
+        *internal_node_num_keys(root) = 1;
+        *internal_node_cell(root, 0) = page_num;
+        *internal_node_key(root, 0) = left_max;
+        *internal_node_right_child(root) = right_page_num;
+        set_node_root(get_page(pager, page_num), false);
+        mark_page_dirty(pager, root_page_num);
+        mark_page_dirty(pager, page_num);
+
+        page_num = root_page_num;
+
+    }
+
+    table->root_page_num = page_num;
+    free(cursor);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+/*
+    Function to delete a row from a copy-on-write tree. A leaf left
+    empty is removed from its parent, and so is a parent left 
+    without children. The separators above a node which lost its
+    largest key are updated on the way up. A root with a single 
+    child is replaced by the child
+*/
+void cow_delete(Table* table, uint32_t key) {
+
+    Pager* pager = table->pager;
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page(pager, cursor->page_num);
+
+    if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+        *leaf_node_key(node, cursor->cell_num) != key) {
+
+        free(cursor);
+        return;
+
+    }
+
+    uint32_t page_num = cow_page(table, cursor->page_num);
+    node = get_page(pager, page_num);
+    leaf_node_remove_cell(node, cursor->cell_num);
+    mark_page_dirty(pager, page_num);
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    bool removed = cursor->depth > 0 && num_cells == 0;
+    bool max_changed = num_cells > 0 && cursor->cell_num == num_cells;
+    uint32_t new_max = max_changed ? *leaf_node_key(node, num_cells - 1) : 0;
+
+    if (removed) {
+        free_page(pager, page_num);
+    }
+
+    for (uint32_t level = cursor->depth; level > 0; level--) {
+
+        uint32_t parent_page_num = cow_page(table, cursor->path_pages[level - 1]);
+        uint32_t index = cursor->path_children[level - 1];
+        void* parent = get_page(pager, parent_page_num);
+        uint32_t num_keys = *internal_node_num_keys(parent);
+
+        if (!removed) {
+
+            *internal_node_child(parent, index) = page_num;
+
+            // Only the maximum of a right child is the parent's maximum
+            if (max_changed && index < num_keys) {
+                *internal_node_key(parent, index) = new_max;
+                max_changed = false;
+            }
+
+        }
+        else if (num_keys == 0) {
+
+            // The parent lost its only child
+            free_page(pager, parent_page_num);
+            continue;
+
+        }
+        else if (index == num_keys) {
+
+            *internal_node_right_child(parent) = *internal_node_cell(parent, 
+                                                                     num_keys - 1);
+            *internal_node_num_keys(parent) = num_keys - 1;
+            new_max = *internal_node_key(parent, num_keys - 1);
+            max_changed = true;
+            removed = false;
+
+        }
+        else {
+
+            internal_node_remove_cell(parent, index);
+            removed = false;
+
+        }
+
+        mark_page_dirty(pager, parent_page_num);
+        page_num = parent_page_num;
+
+    }
+
+    free(cursor);
+
+    // The last row is gone, the table starts over with a leaf root
+    if (removed) {
+
+        page_num = cow_new_page(table);
+        initialize_leaf_node(get_page(pager, page_num));
+        set_node_root(get_page(pager, page_num), true);
+        mark_page_dirty(pager, page_num);
+
+    }
+
+    void* root = get_page(pager, page_num);
+
+    while (get_node_type(root) == NODE_INTERNAL && 
+           *internal_node_num_keys(root) == 0) {
+
+        uint32_t child_page_num = *internal_node_right_child(root);
+
+        free_page(pager, page_num);
+        page_num = cow_page(table, child_page_num);
+        root = get_page(pager, page_num);
+        set_node_root(root, true);
+        mark_page_dirty(pager, page_num);
+
+    }
+
+    table->root_page_num = page_num;
+
+}
+
+/*
+    Function to open a snapshot of the table, from any thread. It
+    reads the tree published last, and later statements do not 
+    change or free any page of it until it is closed. Returns NULL
+    when the table is not in copy-on-write mode, or when every 
+    reader slot is taken
+*/
+Snapshot* db_snapshot_open(Table* table) {
+
+    CopyOnWrite* cow = &table->cow;
+
+    if (!cow->enabled) {
+        return NULL;
+    }
+
+    uint64_t* published = db_header_snapshot(table->pager->map);
+
+    uint64_t snapshot = __atomic_load_n(published, __ATOMIC_SEQ_CST);
+    uint32_t epoch = snapshot >> 32;
+    uint32_t slot = 0;
+
+    for ( ; slot < SNAPSHOT_MAX_READERS; slot++) {
+
+        uint32_t free_slot = 0;
+
+        if (__atomic_compare_exchange_n(&cow->readers[slot], &free_slot, epoch,
+                                        false, __ATOMIC_SEQ_CST, 
+                                        __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+    }
+
+    if (slot == SNAPSHOT_MAX_READERS) {
+        return NULL;
+    }
+
+    /*
+        A statement may have published and freed the pages of the
+        epoch before the slot was taken. The epoch is safe to read
+        once it is still the published one after it was pinned.
+    */
+    uint64_t current;
+    while ((current = __atomic_load_n(published, __ATOMIC_SEQ_CST)) != snapshot) {
+
+        snapshot = current;
+        epoch = snapshot >> 32;
+        __atomic_store_n(&cow->readers[slot], epoch, __ATOMIC_SEQ_CST);
+
+    }
+
+    Snapshot* result = malloc(sizeof(Snapshot));
+    result->table = table;
+    result->root_page_num = (uint32_t)snapshot;
+    result->epoch = epoch;
+    result->slot = slot;
+
+    return result;
+
+}
+
+void db_snapshot_close(Snapshot* snapshot) {
+
+    __atomic_store_n(&snapshot->table->cow.readers[snapshot->slot], 0, 
+                     __ATOMIC_SEQ_CST);
+    free(snapshot);
+
+}
+
+/*
+    Return a cursor of a snapshot at the first row with a key >= 
+    the given key. It is closed with cursor_close() before the
+    snapshot
+*/
+Cursor* snapshot_seek(Snapshot* snapshot, uint32_t key) {
+
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = snapshot->table;
+    cursor->page_num = snapshot->root_page_num;
+    cursor->end_of_table = false;
+    cursor->leaves_followed = 0;
+    cursor->latched = false;
+    cursor->snapshot = true;
+    cursor->depth = 0;
+
+    void* node = cursor_page(cursor, cursor->page_num);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+
+        uint32_t child_index = internal_node_find_child(node, key);
+
+        cursor->path_pages[cursor->depth] = cursor->page_num;
+        cursor->path_children[cursor->depth] = child_index;
+        cursor->depth++;
+
+        cursor->page_num = *internal_node_child(node, child_index);
+        node = cursor_page(cursor, cursor->page_num);
+
+    }
+
+    cursor->cell_num = node_key_lower_bound(leaf_node_key(node, 0),
+                                            LEAF_NODE_SLOT_SIZE,
+                                            *leaf_node_num_cells(node), key);
+    cursor_follow_next_leaf(cursor);
+
+    return cursor;
+
+}
+
+/* Secondary indexes are handled by the following functions
+    - Compare and search index entries within a node
+    - Insert an entry, splitting nodes up to a new root
+    - Build an index over the rows already in the table
+
+    Each index is a B+tree in the db file keyed by (value, id), so
+    equal values are kept in id order. In a leaf the slot key is the
+    row id, in an internal node it is the child page, and the entry
+    of a child's cell is the largest entry under that child. Inserts
+    record the path from the root, so index nodes keep no parent
+    pointers.
+*/
+
+/*
+    Function to build the index entry of a row, returns its length
+*/
+uint32_t index_entry_from_row(Row* row, Column column, void* entry) {
+
+    char* value = (column == COLUMN_USERNAME) ? row->username : row->email;
+    uint32_t value_length = strlen(value);
+
+    memcpy(entry, &(row->id), ID_SIZE);
+    memcpy(entry + ID_SIZE, value, value_length);
+
+    return ID_SIZE + value_length;
+
+}
+
+/*
+    Compare an index entry with (value, id): by the characters of
+    the value, then by its length, then by id
+*/
+int index_entry_compare(void* entry, uint32_t entry_length, 
+                        const char* value, uint32_t value_length, uint32_t id) {
+
+    uint32_t entry_value_length = entry_length - ID_SIZE;
+    uint32_t common_length = (entry_value_length < value_length) 
+                             ? entry_value_length : value_length;
+
+    int result = memcmp(entry + ID_SIZE, value, common_length);
+
+    if (result != 0) {
+        return result;
+    }
+    if (entry_value_length != value_length) {
+        return (entry_value_length < value_length) ? -1 : 1;
+    }
+
+    uint32_t entry_id = *(uint32_t*)entry;
+
+    return (entry_id > id) - (entry_id < id);
+
+}
+
+/*
+    Index of the first cell of an index node whose entry is >= 
+    (value, id), or the number of cells if there is none
+*/
+uint32_t index_node_lower_bound(void* node, const char* value, 
+                                uint32_t value_length, uint32_t id) {
+
+    uint32_t low = 0;
+    uint32_t high = *leaf_node_num_cells(node);
+
+    while (low < high) {
+
+        uint32_t middle = (low + high) / 2;
+
+        if (index_entry_compare(leaf_node_value(node, middle),
+                                *leaf_node_cell_length(node, middle),
+                                value, value_length, id) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+
+    }
+
+    return low;
+
+}
+
+/*
+    Function to fill an empty index node with cells [first, last)
+*/
+void index_node_fill(void* node, IndexCell* cells, uint32_t first, uint32_t last) {
+
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+
+    for (uint32_t i = first; i < last; i++) {
+        leaf_node_append_cell(node, cells[i].key, cells[i].entry, cells[i].length);
+    }
+
+}
+
+/*
+    Function to rewrite the index node at path[depth] with the given
+    cells, and right child for an internal node. Cells which do not
+    fit in one page are split by bytes between the node and a new
+    right sibling, and the parent is rewritten in turn with both
+    halves. A split root gets a new root above it, stored in
+    `root_page_num`. The entries of the cells must not point into
+    the node being rewritten.
+*/
+void index_node_write_cells(Table* table, uint32_t* root_page_num, 
+                            uint32_t* path, uint32_t depth, IndexCell* cells,
+                            uint32_t num_cells, uint32_t right_child) {
+
+    Pager* pager = table->pager;
+    uint32_t page_num = path[depth];
+    void* node = get_page(pager, page_num);
+    NodeType type = get_node_type(node);
+    uint32_t total_bytes = 0;
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+        total_bytes += LEAF_NODE_SLOT_SIZE + cells[i].length;
+    }
+
+    mark_page_dirty(pager, page_num);
+
+    if (total_bytes <= LEAF_NODE_SPACE_FOR_CELLS) {
+
+        index_node_fill(node, cells, 0, num_cells);
+        if (type == NODE_INDEX_INTERNAL) {
+            *index_node_right_child(node) = right_child;
+        }
+        return;
+
+    }
+
+    uint32_t left_count = 1;
+    uint32_t left_bytes = LEAF_NODE_SLOT_SIZE + cells[0].length;
+
+    while (left_count < num_cells - 2 &&
+           2 * (left_bytes + LEAF_NODE_SLOT_SIZE + cells[left_count].length) 
+           <= total_bytes) {
+
+        left_bytes += LEAF_NODE_SLOT_SIZE + cells[left_count].length;
+        left_count++;
+
+    }
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    IndexCell separator;
+
+    initialize_index_node(new_node, type);
+    mark_page_dirty(pager, new_page_num);
+
+    if (type == NODE_INDEX_LEAF) {
+
+        index_node_fill(node, cells, 0, left_count);
+        index_node_fill(new_node, cells, left_count, num_cells);
+
+        *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(node);
+        *leaf_node_next_leaf(node) = new_page_num;
+        separator = cells[left_count - 1];
+
+    }
+    else {
+
+        // The middle cell moves up, its child is the left right child
+        index_node_fill(node, cells, 0, left_count);
+        *index_node_right_child(node) = cells[left_count].key;
+
+        index_node_fill(new_node, cells, left_count + 1, num_cells);
+        *index_node_right_child(new_node) = right_child;
+        separator = cells[left_count];
+
+    }
+
+    separator.key = page_num;
+
+    if (depth == 0) {
+
+        uint32_t new_root_page_num = get_unused_page_num(pager);
+        void* root = get_page(pager, new_root_page_num);
+
+        initialize_index_node(root, NODE_INDEX_INTERNAL);
+        leaf_node_append_cell(root, separator.key, separator.entry, separator.length);
+        *index_node_right_child(root) = new_page_num;
+        mark_page_dirty(pager, new_root_page_num);
+
+        *root_page_num = new_root_page_num;
+        return;
+
+    }
+
+    /*
+        The parent cell of the node now covers the left half, and a
+        cell with the old entry follows it for the new right half
+    */
+
+    uint32_t parent_page_num = path[depth - 1];
+    void* parent = get_page(pager, parent_page_num);
+    uint8_t scratch[PAGE_SIZE];
+    uint32_t parent_num_cells = *leaf_node_num_cells(parent);
+    uint32_t parent_right_child = *index_node_right_child(parent);
+    IndexCell parent_cells[parent_num_cells + 1];
+    uint32_t count = 0;
+
+    memcpy(scratch, parent, PAGE_SIZE);
+
+    for (uint32_t i = 0; i < parent_num_cells; i++) {
+
+        IndexCell cell = { *leaf_node_key(scratch, i),
+                           leaf_node_value(scratch, i),
+                           *leaf_node_cell_length(scratch, i) };
+
+        if (cell.key == page_num) {
+            parent_cells[count++] = separator;
+            cell.key = new_page_num;
+        }
+
+        parent_cells[count++] = cell;
+
+    }
+
+    if (parent_right_child == page_num) {
+        parent_cells[count++] = separator;
+        parent_right_child = new_page_num;
+    }
+
+    index_node_write_cells(table, root_page_num, path, depth - 1,
+                           parent_cells, count, parent_right_child);
+
+}
+
+/*
+    Function to add the entry of a row to the index rooted at 
+    `root_page_num`, which is updated if the root splits
+*/
+void index_insert(Table* table, uint32_t* root_page_num, 
+                  Row* row, Column column) {
+
+    Pager* pager = table->pager;
+    uint8_t entry[INDEX_ENTRY_MAX_SIZE];
+    uint32_t entry_length = index_entry_from_row(row, column, entry);
+    const char* value = (const char*)(entry + ID_SIZE);
+    uint32_t value_length = entry_length - ID_SIZE;
+
+    uint32_t path[INDEX_MAX_DEPTH];
+    uint32_t depth = 0;
+    uint32_t page_num = *root_page_num;
+    void* node = get_page(pager, page_num);
+
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+
+        uint32_t child_num = index_node_lower_bound(node, value, 
+                                                    value_length, row->id);
+
+        path[depth++] = page_num;
+        page_num = index_node_child(node, child_num);
+        node = get_page(pager, page_num);
+
+    }
+
+    path[depth] = page_num;
+
+    uint32_t cell_num = index_node_lower_bound(node, value, value_length, row->id);
+
+    if (leaf_node_has_room(node, entry_length)) {
+
+        leaf_node_insert_cell(node, cell_num, row->id, entry, entry_length);
+        mark_page_dirty(pager, page_num);
+        return;
+
+    }
+
+    // Leaf is full, rewrite it from a copy with the new cell in place
+    uint8_t scratch[PAGE_SIZE];
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    IndexCell cells[num_cells + 1];
+
+    memcpy(scratch, node, PAGE_SIZE);
+
+    for (uint32_t i = 0, j = 0; j <= num_cells; j++) {
+
+        if (j == cell_num) {
+            cells[j] = (IndexCell){ row->id, entry, entry_length };
+        }
+        else {
+            cells[j] = (IndexCell){ *leaf_node_key(scratch, i),
+                                    leaf_node_value(scratch, i),
+                                    *leaf_node_cell_length(scratch, i) };
+            i++;
+        }
+
+    }
+
+    index_node_write_cells(table, root_page_num, path, depth, cells, 
+                           num_cells + 1, INVALID_PAGE_NUM);
+
+}
+
+/*
+    Function to add the rows of an insert to every index of the 
+    table, recording new index roots in the header page
+*/
+void index_insert_rows(Table* table, Row* rows, uint32_t num_rows) {
+
+    Pager* pager = table->pager;
+
+    for (Column column = COLUMN_USERNAME; column <= COLUMN_EMAIL; column++) {
+
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        uint32_t root_page_num = *db_header_index_root(header, column);
+
+        if (root_page_num == INVALID_PAGE_NUM) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < num_rows; i++) {
+            index_insert(table, &root_page_num, &rows[i], column);
+        }
+
+        if (root_page_num != *db_header_index_root(header, column)) {
+            *db_header_index_root(header, column) = root_page_num;
+            mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        }
+
+    }
+
+}
+
+/*
+    Function to remove the entry of a row from the index rooted at
+    `root_page_num`. Index leaves are not merged: a leaf left empty
+    stays in the chain, and the separators above it remain valid
+    upper bounds for searches and inserts
+*/
+void index_delete(Table* table, uint32_t root_page_num, Row* row, Column column) {
+
+    Pager* pager = table->pager;
+    uint8_t entry[INDEX_ENTRY_MAX_SIZE];
+    uint32_t entry_length = index_entry_from_row(row, column, entry);
+    const char* value = (const char*)(entry + ID_SIZE);
+    uint32_t value_length = entry_length - ID_SIZE;
+
+    uint32_t page_num = root_page_num;
+    void* node = get_page(pager, page_num);
+
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+
+        uint32_t child_num = index_node_lower_bound(node, value, 
+                                                    value_length, row->id);
+
+        page_num = index_node_child(node, child_num);
+        node = get_page(pager, page_num);
+
+    }
+
+    uint32_t cell_num = index_node_lower_bound(node, value, value_length, row->id);
+
+    if (cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cell_num) == row->id) {
+
+        leaf_node_remove_cell(node, cell_num);
+        mark_page_dirty(pager, page_num);
+
+    }
+
+}
+
+/*
+    Function to remove a deleted row from every index of the table
+*/
+void index_delete_row(Table* table, Row* row) {
+
+    void* header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+
+    for (Column column = COLUMN_USERNAME; column <= COLUMN_EMAIL; column++) {
+
+        uint32_t root_page_num = *db_header_index_root(header, column);
+
+        if (root_page_num != INVALID_PAGE_NUM) {
+            index_delete(table, root_page_num, row, column);
+        }
+
+    }
+
+}
+
+/*
+    Function to add every row of the table to the index rooted at
+    `root_page_num`. Pages are committed every few rows so a large
+    table does not keep the whole index pinned; the caller records
+    the root in the header only once the index is complete
+*/
+void index_build(Table* table, uint32_t* root_page_num, Column column) {
+
+    Cursor* cursor = table_start(table);
+    uint32_t rows_indexed = 0;
+    Row row;
+
+    while (!cursor->end_of_table) {
+
+        deserialize_row(cursor_value(cursor), &row);
+        index_insert(table, root_page_num, &row, column);
+        cursor_advance(cursor);
+
+        if (++rows_indexed % INDEX_BUILD_COMMIT_ROWS == 0) {
+            pager_commit(table->pager);
+        }
+
+    }
+
+    free(cursor);
+
+}
+
+/*
+    Function to position an index cursor on the first entry which is
+    >= (value, 0), the first row with the given value if there is one.
+    The cursor walks the index leaves with the usual cursor functions
+*/
+Cursor* index_seek(Table* table, uint32_t root_page_num, 
+                   const char* value, uint32_t value_length) {
+
+    uint32_t page_num = root_page_num;
+    void* node = get_page_unpinned(table->pager, page_num);
+
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+
+        uint32_t child_num = index_node_lower_bound(node, value, value_length, 0);
+
+        page_num = index_node_child(node, child_num);
+        node = get_page_unpinned(table->pager, page_num);
+
+    }
+
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = index_node_lower_bound(node, value, value_length, 0);
+    cursor->end_of_table = false;
+    cursor->leaves_followed = 0;
+    cursor->latched = false;
+    cursor->depth = 0;
+    cursor->snapshot = false;
+    cursor_follow_next_leaf(cursor);
+
+    return cursor;
+
+}
+
+/*
+    Print a prompt for the user
+*/
+void print_prompt() {
+    printf("db>");
+}
+
+/*
+    Function to print out the necessary constants
+*/
+void print_constants() {
+
+    printf("ROW_MAX_SIZE: %d\n", ROW_MAX_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    printf("INTERNAL_NODE_HEADER_SIZE: %d\n", INTERNAL_NODE_HEADER_SIZE);
+    printf("INTERNAL_NODE_MAX_CELLS: %d\n", INTERNAL_NODE_MAX_CELLS);
+
+}
+
+/*
+    Functions to visualize the btree representation
+*/
+void indent(uint32_t level) {
+
+    for (uint32_t i = 0; i < level; i++) {
+        printf("   ");
+    }
+
+}
+
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+
+    // Unpinned, so the node is fetched again after visiting a child
+    void* node = get_page_unpinned(pager, page_num);
+    uint32_t num_keys, child;
+
+    switch (get_node_type(node))
+    {
+        case NODE_INTERNAL:
+           
+            num_keys = *internal_node_num_keys(node);
+            indent(indentation_level);
+            printf("- internal (size %d)\n", num_keys);
+
+            for (uint32_t i = 0; i < num_keys; i++) {
+
+                child = *internal_node_child(node, i);
+                print_tree(pager, child, indentation_level + 1);
+                node = get_page_unpinned(pager, page_num);
+
+                indent(indentation_level + 1);
+                printf("- key %d\n", *internal_node_key(node, i));
+
+            }
+
+            child = *internal_node_right_child(node);
+            print_tree(pager, child, indentation_level + 1);
+
+            break;
+        
+        case NODE_LEAF:
+
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            printf("- leaf node (size %d)\n", num_keys);
+
+            for (uint32_t i = 0; i < num_keys; i++) {
+
+                indent(indentation_level + 1);
+                printf("- key %d\n", *leaf_node_key(node, i));
+
+            }
+
+            break;
+
+        default:
+            // Index pages are not part of the table tree
+            break;
+    }
+
+}
+
+/*
+    Read input from STDIN
+*/
+void read_input(InputBuffer* input_buffer) {
+
+    ssize_t bytes_read = getline(&(input_buffer->buffer), 
+                            &(input_buffer->buffer_length), stdin);
+
+    if (bytes_read <= 0) {
+        
+        printf("Error reading input\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    input_buffer->input_length = bytes_read - 1;
+    input_buffer->buffer[bytes_read - 1] = 0;
+}
+
+/* 
+    Function to free allocated memory for the instance of InputBuffer
+*/
+void close_input_buffer(InputBuffer* input_buffer) {
+
+    free(input_buffer->buffer);
+    free(input_buffer);
+
+}
+
+/*
+    Function to flush a cached page to the db file
+*/
+void pager_flush(Pager* pager, uint32_t page_num) {
+
+    if (pager->mode == PAGER_MMAP) {
+
+        if (msync(pager->map + (off_t)page_num * PAGE_SIZE, PAGE_SIZE, 
+                  MS_SYNC) == -1) {
+
+            printf("Error syncing: %d\n", errno);
+            exit(EXIT_FAILURE);
+
+        }
+
+        return;
+
+    }
+
+    uint32_t index = pager_lookup_frame(pager, page_num);
+
+    if (index == INVALID_FRAME) {
+
+        printf("Tried to flush null page.\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (pager->frames[index].io_pending) {
+        async_io_wait_frame(pager, index);
+    }
+
+    pager_write_frame(pager, &pager->frames[index]);
+
+}
+
+/*
+    Flush dirty pages to disk, close the file, free memory for
+    the buffer pool, pager and Table data structures
+*/
+void db_close(Table* table) {
+    
+    Pager* pager = table->pager;
+
+    cow_close(table);
+
+    if (pager->mode == PAGER_MMAP) {
+
+        off_t used_length = (off_t)pager->num_pages * PAGE_SIZE;
+
+        if (msync(pager->map, used_length, MS_SYNC) == -1) {
+            printf("Error syncing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        munmap(pager->map, MMAP_RESERVE_SIZE);
+
+        if (ftruncate(pager->file_descriptor, used_length) == -1) {
+            printf("Error truncating file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    if (pager->wal_enabled) {
+
+        wal_checkpoint(pager);
+        close(pager->wal_file_descriptor);
+        free(pager->wal_buffer);
+        free(pager->wal_pending);
+        free(pager->wal_logging);
+        pthread_cond_destroy(&pager->wal_synced);
+
+    }
+
+    pager_write_dirty_frames(pager);
+    async_io_close(pager);
+
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+
+        pthread_rwlock_destroy(pager->frames[i].latch);
+        free(pager->frames[i].latch);
+        free(pager->frames[i].data);
+
+    }
+
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+
+        printf("Error closing the db file.\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    free(pager->frames);
+    free(pager->page_table);
+    free(pager->statement_pins);
+    pthread_mutex_destroy(&pager->pool_lock);
+    pthread_mutex_destroy(&pager->wal_lock);
+    pthread_cond_destroy(&pager->frame_loaded);
+    free(pager);
+    pthread_rwlock_destroy(&table->tree_latch);
+    pthread_mutex_destroy(&table->tree_turnstile);
+    free(table->sink.buffer);
+    free(table);
+}
+
+ExecuteResult bulk_load(Table* table, FILE* input, uint32_t* rows_loaded);
+void db_sync(Table* table);
+
+/*
+    Function to look up an output format by the name used by
+    `.mode` and `--format`
+*/
+bool parse_output_format(const char* name, OutputFormat* format) {
+
+    if (strcmp(name, "text") == 0) {
+        *format = OUTPUT_TEXT;
+    }
+    else if (strcmp(name, "csv") == 0) {
+        *format = OUTPUT_CSV;
+    }
+    else if (strcmp(name, "tsv") == 0) {
+        *format = OUTPUT_TSV;
+    }
+    else if (strcmp(name, "binary") == 0) {
+        *format = OUTPUT_BINARY;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+
+}
+
+/*
+    Function to look up an I/O backend by the name used by `--io`
+*/
+bool parse_io_backend(const char* name, IoBackend* backend) {
+
+    if (strcmp(name, "uring") == 0) {
+        *backend = IO_URING;
+    }
+    else if (strcmp(name, "threads") == 0) {
+        *backend = IO_THREADS;
+    }
+    else if (strcmp(name, "sync") == 0) {
+        *backend = IO_SYNC;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+
+}
+
+/*
+    Wrapper that handles non-SQL commands like '.exit' and leaves room for more 
+    such commands
+*/
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+
+    if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    }
+
+    else if (strncmp(input_buffer->buffer, ".load ", 6) == 0) {
+
+        char* load_filename = input_buffer->buffer + 6;
+        FILE* input = fopen(load_filename, "r");
+
+        if (input == NULL) {
+            printf("Unable to open '%s'.\n", load_filename);
+            return META_COMMAND_SUCCESS;
+        }
+
+        uint32_t rows_loaded = 0;
+        ExecuteResult result = bulk_load(table, input, &rows_loaded);
+        db_sync(table);
+
+        switch (result) {
+
+            case (EXECUTE_SUCCESS):
+                printf("Loaded %d rows.\n", rows_loaded);
+                break;
+
+            case (EXECUTE_TABLE_NOT_EMPTY):
+                printf("Error: Bulk load requires an empty table.\n");
+                break;
+
+            case (EXECUTE_UNSORTED_INPUT):
+                printf("Error: Rows are not sorted by id, at row %d.\n",
+                       rows_loaded + 1);
+                break;
+
+            default:
+                printf("Error: Could not parse row %d.\n", rows_loaded + 1);
+                break;
+
+        }
+
+        cow_publish(table);
+        fclose(input);
+        return META_COMMAND_SUCCESS;
+
+    }
+
+    else if (strncmp(input_buffer->buffer, ".mode ", 6) == 0) {
+
+        if (!parse_output_format(input_buffer->buffer + 6, 
+                                 &(table->sink.format))) {
+            printf("Unknown output format '%s'.\n", input_buffer->buffer + 6);
+        }
+        return META_COMMAND_SUCCESS;
+
+    }
+
+    else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+
+        if (table->pager->wal_enabled) {
+            wal_checkpoint(table->pager);
+        }
+        return META_COMMAND_SUCCESS;
+
+    }
+
+    else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(table->pager, table->root_page_num, 0);
+        return META_COMMAND_SUCCESS;
+    }
+
+    else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+        printf("Constants:\n");
+        print_constants();
+        return META_COMMAND_SUCCESS;
+    }
+
+    else {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+
+}
+
+/* 
+    SQL compiler
+*/
+
+/*
+    Function to free the rows of a multi-row insert statement, the
+    ids of a point lookup and the parameters
+*/
+void close_statement(Statement* statement) {
+
+    if (statement->rows_to_insert != &(statement->row_to_insert)) {
+
+        free(statement->rows_to_insert);
+        statement->rows_to_insert = &(statement->row_to_insert);
+
+    }
+
+    free(statement->where_ids);
+    statement->where_ids = NULL;
+    statement->num_where_ids = 0;
+
+    free(statement->parameters);
+    statement->parameters = NULL;
+    statement->num_parameters = 0;
+
+}
+
+int compare_keys(const void* a, const void* b) {
+
+    uint32_t key_a = *(const uint32_t*)a;
+    uint32_t key_b = *(const uint32_t*)b;
+
+    return (key_a > key_b) - (key_a < key_b);
+
+}
+
+/*
+    Function to sort keys and drop the duplicates, returning how
+    many are left
+*/
+uint32_t sort_unique_keys(uint32_t* keys, uint32_t num_keys) {
+
+    if (num_keys == 0) {
+        return 0;
+    }
+
+    qsort(keys, num_keys, sizeof(uint32_t), compare_keys);
+
+    uint32_t num_unique = 1;
+    for (uint32_t i = 1; i < num_keys; i++) {
+        if (keys[i] != keys[num_unique - 1]) {
+            keys[num_unique++] = keys[i];
+        }
+    }
+
+    return num_unique;
+
+}
+
+// Character classes of the lexer, looked up per character
+#define LEXER_SPACE 1
+#define LEXER_DELIMITER 2
+
+const uint8_t LEXER_CLASSES[256] = {
+    ['\t'] = LEXER_SPACE | LEXER_DELIMITER,
+    ['\n'] = LEXER_SPACE | LEXER_DELIMITER,
+    ['\r'] = LEXER_SPACE | LEXER_DELIMITER,
+    [' '] = LEXER_SPACE | LEXER_DELIMITER,
+    ['('] = LEXER_DELIMITER,
+    [')'] = LEXER_DELIMITER,
+    [','] = LEXER_DELIMITER
+};
+
+#define lexer_is_space(c) (LEXER_CLASSES[(uint8_t)(c)] & LEXER_SPACE)
+#define lexer_is_delimiter(c) (LEXER_CLASSES[(uint8_t)(c)] & LEXER_DELIMITER)
+
+/*
+    Lexer, producing the token after the current one. Tokens are 
+    separated by whitespace, and `(`, `)` and `,` are tokens of 
+    their own. Any other run of characters is a word, which is a 
+    number when it is digits with an optional minus sign, and a 
+    parameter or an equals sign when it is only `?` or `=`, so 
+    values such as emails need no quoting. The text ends at 
+    `parser->end`, so a statement can be read where it lies in a 
+    larger buffer
+*/
+void parser_advance(Parser* parser) {
+
+    const char* start = parser->position;
+    const char* end = parser->end;
+    Token* token = &(parser->token);
+
+    while (start < end && lexer_is_space(*start)) {
+        start++;
+    }
+
+    token->start = start;
+    token->length = 1;
+
+    if (start == end) {
+
+        token->type = TOKEN_END;
+        token->length = 0;
+        parser->position = start;
+        return;
+
+    }
+
+    switch (*start) {
+
+        case ('('):
+            token->type = TOKEN_LEFT_PAREN;
+            break;
+
+        case (')'):
+            token->type = TOKEN_RIGHT_PAREN;
+            break;
+
+        case (','):
+            token->type = TOKEN_COMMA;
+            break;
+
+        default:
+
+            while (start + token->length < end && 
+                   !lexer_is_delimiter(start[token->length])) {
+                token->length++;
+            }
+            token->type = TOKEN_WORD;
+
+            if (token->length == 1 && *start == '?') {
+                token->type = TOKEN_PARAMETER;
+            }
+            else if (token->length == 1 && *start == '=') {
+                token->type = TOKEN_EQUALS;
+            }
+            else {
+
+                uint32_t sign = *start == '-';
+                uint32_t digits = 0;
+
+                while (sign + digits < token->length && 
+                       start[sign + digits] >= '0' && start[sign + digits] <= '9') {
+                    digits++;
+                }
+
+                if (digits > 0 && sign + digits == token->length) {
+                    token->type = TOKEN_NUMBER;
+                }
+
+            }
+
+    }
+
+    parser->position = start + token->length;
+
+}
+
+void parser_init(Parser* parser, const char* text, uint32_t length,
+                 Statement* statement) {
+
+    statement->rows_to_insert = &(statement->row_to_insert);
+    statement->num_rows = 0;
+    statement->where_ids = NULL;
+    statement->num_where_ids = 0;
+    statement->parameters = NULL;
+    statement->num_parameters = 0;
+
+    parser->position = text;
+    parser->end = text + length;
+    parser->statement = statement;
+    parser->rows_capacity = 1;
+    parser->ids_capacity = 0;
+    parser->parameters_capacity = 0;
+
+    parser_advance(parser);
+
+}
+
+bool parser_accept(Parser* parser, TokenType type) {
+
+    if (parser->token.type != type) {
+        return false;
+    }
+
+    parser_advance(parser);
+    return true;
+
+}
+
+// Keywords are words, matched case-sensitively
+bool parser_accept_word(Parser* parser, const char* word) {
+
+    Token* token = &(parser->token);
+
+    if (token->type != TOKEN_WORD || token->length != strlen(word) ||
+        memcmp(token->start, word, token->length) != 0) {
+        return false;
+    }
+
+    parser_advance(parser);
+    return true;
+
+}
+
+void parser_add_parameter(Parser* parser, ParameterTarget target, 
+                          uint32_t position) {
+
+    Statement* statement = parser->statement;
+
+    if (statement->num_parameters == parser->parameters_capacity) {
+
+        parser->parameters_capacity = parser->parameters_capacity == 0 
+                                      ? 4 : parser->parameters_capacity * 2;
+        statement->parameters = realloc(statement->parameters,
+                                        parser->parameters_capacity * 
+                                        sizeof(Parameter));
+
+    }
+
+    Parameter* parameter = &(statement->parameters[statement->num_parameters++]);
+    parameter->target = target;
+    parameter->position = position;
+    parameter->bound = false;
+
+}
+
+/*
+    Function to read an id, or a parameter standing for it. Ids are
+    checked for overflow rather than wrapped around
+*/
+PrepareResult parser_id(Parser* parser, ParameterTarget target, 
+                        uint32_t position, uint32_t* id) {
+
+    Token* token = &(parser->token);
+
+    if (token->type == TOKEN_PARAMETER) {
+
+        parser_add_parameter(parser, target, position);
+        *id = 0;
+        parser_advance(parser);
+        return PREPARE_SUCCESS;
+
+    }
+
+    if (token->type != TOKEN_NUMBER) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    bool negative = *token->start == '-';
+    uint64_t value = 0;
+
+    for (uint32_t i = negative; i < token->length; i++) {
+
+        value = value * 10 + (token->start[i] - '0');
+
+        if (value > UINT32_MAX) {
+            return negative ? PREPARE_NEGATIVE_ID : PREPARE_ID_TOO_LARGE;
+        }
+
+    }
+
+    if (negative && value > 0) {
+        return PREPARE_NEGATIVE_ID;
+    }
+
+    *id = value;
+    parser_advance(parser);
+
+    return PREPARE_SUCCESS;
+
+}
+
+/*
+    Function to read a string value, or a parameter standing for it,
+    into `value`, which has room for `max_length` characters
+*/
+PrepareResult parser_value(Parser* parser, ParameterTarget target,
+                           uint32_t position, char* value, uint32_t max_length) {
+
+    Token* token = &(parser->token);
+
+    if (token->type == TOKEN_PARAMETER) {
+
+        parser_add_parameter(parser, target, position);
+        value[0] = '\0';
+        parser_advance(parser);
+        return PREPARE_SUCCESS;
+
+    }
+
+    if (token->type != TOKEN_WORD && token->type != TOKEN_NUMBER) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token->length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+
+    memcpy(value, token->start, token->length);
+    value[token->length] = '\0';
+    parser_advance(parser);
+
+    return PREPARE_SUCCESS;
+
+}
+
+/*
+    Function to read the values of a row, separated by commas when
+    `commas` is set:
+        <id> <username> <email>
+*/
+PrepareResult parser_row(Parser* parser, Row* row, uint32_t position,
+                         bool commas) {
+
+    PrepareResult result = parser_id(parser, PARAMETER_ROW_ID, position, 
+                                     &(row->id));
+
+    if (result == PREPARE_SUCCESS && commas && !parser_accept(parser, TOKEN_COMMA)) {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        result = parser_value(parser, PARAMETER_ROW_USERNAME, position,
+                              row->username, COLUMN_USERNAME_SIZE);
+    }
+    if (result == PREPARE_SUCCESS && commas && !parser_accept(parser, TOKEN_COMMA)) {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        result = parser_value(parser, PARAMETER_ROW_EMAIL, position,
+                              row->email, COLUMN_EMAIL_SIZE);
+    }
+
+    return result;
+
+}
+
+/*
+    Function to parse the insert statements, of one row or of 
+    several rows applied together:
+        insert <id> <username> <email>
+        insert (<id>, <username>, <email>), (...), ...
+*/
+PrepareResult parse_insert(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    statement->type = STATEMENT_INSERT;
+
+    if (parser->token.type != TOKEN_LEFT_PAREN) {
+
+        statement->num_rows = 1;
+        return parser_row(parser, &(statement->row_to_insert), 0, false);
+
+    }
+
+    parser->rows_capacity = 16;
+    statement->rows_to_insert = malloc(parser->rows_capacity * sizeof(Row));
+
+    do {
+
+        if (!parser_accept(parser, TOKEN_LEFT_PAREN)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        if (statement->num_rows == parser->rows_capacity) {
+
+            parser->rows_capacity *= 2;
+            statement->rows_to_insert = realloc(statement->rows_to_insert,
+                                                parser->rows_capacity * 
+                                                sizeof(Row));
+
+        }
+
+        Row* row = &(statement->rows_to_insert[statement->num_rows]);
+        PrepareResult result = parser_row(parser, row, statement->num_rows, true);
+
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!parser_accept(parser, TOKEN_RIGHT_PAREN)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        statement->num_rows += 1;
+
+    } while (parser_accept(parser, TOKEN_COMMA));
+
+    return PREPARE_SUCCESS;
+
+}
+
+bool parser_column(Parser* parser, Column* column) {
+
+    if (parser_accept_word(parser, "id")) {
+        *column = COLUMN_ID;
+    }
+    else if (parser_accept_word(parser, "username")) {
+        *column = COLUMN_USERNAME;
+    }
+    else if (parser_accept_word(parser, "email")) {
+        *column = COLUMN_EMAIL;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+
+}
+
+/*
+    Function to parse an item of the select list, a column or an
+    aggregate. Aggregates and columns cannot be mixed
+*/
+PrepareResult parser_select_item(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    Aggregate aggregate;
+    Column column;
+
+    if (parser_accept_word(parser, "count")) {
+        aggregate = AGGREGATE_COUNT;
+    }
+    else if (parser_accept_word(parser, "min")) {
+        aggregate = AGGREGATE_MIN_ID;
+    }
+    else if (parser_accept_word(parser, "max")) {
+        aggregate = AGGREGATE_MAX_ID;
+    }
+    else if (parser_column(parser, &column)) {
+
+        if (statement->num_aggregates > 0 ||
+            statement->num_columns == MAX_SELECT_COLUMNS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->columns[statement->num_columns++] = column;
+
+        return PREPARE_SUCCESS;
+
+    }
+    else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    // count takes `*`, min and max the id
+    if (!parser_accept(parser, TOKEN_LEFT_PAREN) || 
+        !parser_accept_word(parser, aggregate == AGGREGATE_COUNT ? "*" : "id") ||
+        !parser_accept(parser, TOKEN_RIGHT_PAREN)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (statement->num_columns > 0 ||
+        statement->num_aggregates == MAX_SELECT_COLUMNS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->aggregates[statement->num_aggregates++] = aggregate;
+
+    return PREPARE_SUCCESS;
+
+}
+
+PrepareResult parser_where_id(Parser* parser) {
+
+    Statement* statement = parser->statement;
+
+    if (statement->num_where_ids == parser->ids_capacity) {
+
+        parser->ids_capacity = parser->ids_capacity == 0 
+                               ? 16 : parser->ids_capacity * 2;
+        statement->where_ids = realloc(statement->where_ids,
+                                       parser->ids_capacity * sizeof(uint32_t));
+
+    }
+
+    uint32_t position = statement->num_where_ids;
+    PrepareResult result = parser_id(parser, PARAMETER_WHERE_ID, position,
+                                     &(statement->where_ids[position]));
+
+    if (result == PREPARE_SUCCESS) {
+        statement->num_where_ids += 1;
+    }
+
+    return result;
+
+}
+
+/*
+    Function to parse the filter of a select. An id list is sorted
+    and without duplicates once its ids are known, since the rows
+    are looked up in key order; `id = <id>` is a list of one
+        id between <low> and <high>
+        id = <id>
+        id in (<id>, ...)
+        <username | email> = <value>
+*/
+PrepareResult parse_select_where(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    PrepareResult result;
+
+    if (parser_accept_word(parser, "id")) {
+
+        if (parser_accept_word(parser, "between")) {
+
+            statement->where_type = WHERE_ID_BETWEEN;
+            result = parser_id(parser, PARAMETER_WHERE_LOW, 0, 
+                               &(statement->where_low));
+
+            if (result == PREPARE_SUCCESS && !parser_accept_word(parser, "and")) {
+                result = PREPARE_SYNTAX_ERROR;
+            }
+            if (result == PREPARE_SUCCESS) {
+                result = parser_id(parser, PARAMETER_WHERE_HIGH, 0, 
+                                   &(statement->where_high));
+            }
+
+            return result;
+
+        }
+
+        statement->where_type = WHERE_ID_IN;
+
+        if (parser_accept(parser, TOKEN_EQUALS)) {
+            return parser_where_id(parser);
+        }
+
+        if (!parser_accept_word(parser, "in") || 
+            !parser_accept(parser, TOKEN_LEFT_PAREN)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        do {
+
+            result = parser_where_id(parser);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+
+        } while (parser_accept(parser, TOKEN_COMMA));
+
+        return parser_accept(parser, TOKEN_RIGHT_PAREN) ? PREPARE_SUCCESS 
+                                                        : PREPARE_SYNTAX_ERROR;
+
+    }
+
+    if (!parser_column(parser, &(statement->where_column)) ||
+        statement->where_column == COLUMN_ID ||
+        !parser_accept(parser, TOKEN_EQUALS)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    statement->where_type = WHERE_COLUMN_EQUALS;
+
+    return parser_value(parser, PARAMETER_WHERE_VALUE, 0, statement->where_value,
+                        statement->where_column == COLUMN_USERNAME 
+                        ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE);
+
+}
+
+/*
+    Function to parse the select statements, either a full scan, a 
+    range scan or point lookups on the primary key or an equality 
+    filter on a string column, optionally with a list of columns or
+    aggregates to print:
+        select [<column>, ...] [where <filter>]
+        select <count(*) | min(id) | max(id)>, ... [where <filter>]
+*/
+PrepareResult parse_select(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    statement->type = STATEMENT_SELECT;
+    statement->where_type = WHERE_NONE;
+    statement->num_columns = 0;
+    statement->num_aggregates = 0;
+
+    if (parser_accept_word(parser, "where")) {
+        return parse_select_where(parser);
+    }
+    if (parser->token.type == TOKEN_END) {
+        return PREPARE_SUCCESS;
+    }
+
+    do {
+
+        PrepareResult result = parser_select_item(parser);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+
+    } while (parser_accept(parser, TOKEN_COMMA));
+
+    if (parser_accept_word(parser, "where")) {
+        return parse_select_where(parser);
+    }
+
+    return PREPARE_SUCCESS;
+
+}
+
+/*
+    Function to parse the delete statements, on a single id, a 
+    range of ids or the whole table:
+        delete where id = <id>
+        delete where id between <low> and <high>
+        delete
+*/
+PrepareResult parse_delete(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    statement->type = STATEMENT_DELETE;
+    statement->where_type = WHERE_ID_BETWEEN;
+    statement->where_low = 0;
+    statement->where_high = UINT32_MAX;
+
+    if (parser->token.type == TOKEN_END) {
+        return PREPARE_SUCCESS;
+    }
+
+    if (!parser_accept_word(parser, "where") || 
+        !parser_accept_word(parser, "id")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (parser_accept(parser, TOKEN_EQUALS)) {
+
+        PrepareResult result = parser_id(parser, PARAMETER_WHERE_KEY, 0,
+                                         &(statement->where_low));
+        statement->where_high = statement->where_low;
+
+        return result;
+
+    }
+
+    if (!parser_accept_word(parser, "between")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    PrepareResult result = parser_id(parser, PARAMETER_WHERE_LOW, 0, 
+                                     &(statement->where_low));
+
+    if (result == PREPARE_SUCCESS && !parser_accept_word(parser, "and")) {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        result = parser_id(parser, PARAMETER_WHERE_HIGH, 0, 
+                           &(statement->where_high));
+    }
+
+    return result;
+
+}
+
+/*
+    Function to parse the create index statements:
+        create index on <username | email>
+*/
+PrepareResult parse_create_index(Parser* parser) {
+
+    Statement* statement = parser->statement;
+    statement->type = STATEMENT_CREATE_INDEX;
+
+    if (!parser_accept_word(parser, "index") || 
+        !parser_accept_word(parser, "on") ||
+        !parser_column(parser, &(statement->index_column)) ||
+        statement->index_column == COLUMN_ID) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    return PREPARE_SUCCESS;
+
+}
+
+/*
+    Function to compile the text of a statement in one pass over its
+    tokens. `?` parameters are allowed, recorded in the statement 
+    with the field each one fills in
+*/
+PrepareResult parse_statement(const char* text, uint32_t length, 
+                              Statement* statement) {
+
+    Parser parser;
+    PrepareResult result;
+
+    parser_init(&parser, text, length, statement);
+
+    if (parser_accept_word(&parser, "insert")) {
+        result = parse_insert(&parser);
+    }
+    else if (parser_accept_word(&parser, "select")) {
+        result = parse_select(&parser);
+    }
+    else if (parser_accept_word(&parser, "delete")) {
+        result = parse_delete(&parser);
+    }
+    else if (parser_accept_word(&parser, "create")) {
+        result = parse_create_index(&parser);
+    }
+    else {
+        result = PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    if (result == PREPARE_SUCCESS && parser.token.type != TOKEN_END) {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+
+    if (result != PREPARE_SUCCESS) {
+        close_statement(statement);
+        return result;
+    }
+
+    if (statement->type == STATEMENT_SELECT && 
+        statement->where_type == WHERE_ID_IN && statement->num_parameters == 0) {
+        statement->num_where_ids = sort_unique_keys(statement->where_ids, 
+                                                    statement->num_where_ids);
+    }
+
+    return PREPARE_SUCCESS;
+
+}
+
+/*
+    Function to compile a row of `.load`, `<id> <username> <email>`
+*/
+PrepareResult parse_row(const char* text, uint32_t length, Row* row) {
+
+    Statement statement;
+    Parser parser;
+
+    parser_init(&parser, text, length, &statement);
+
+    PrepareResult result = parser_row(&parser, row, 0, false);
+
+    if (result == PREPARE_SUCCESS && 
+        (parser.token.type != TOKEN_END || statement.num_parameters > 0)) {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+
+    close_statement(&statement);
+
+    return result;
+
+}
+
+const char* prepare_result_message(PrepareResult result) {
+
+    switch (result) {
+
+        case (PREPARE_SUCCESS):
+            return "Prepared.";
+
+        case (PREPARE_NEGATIVE_ID):
+            return "ID cannot be negative.";
+
+        case (PREPARE_SYNTAX_ERROR):
+            return "Syntax error. Could not parse statement.";
+
+        case (PREPARE_STRING_TOO_LONG):
+            return "String is too long.";
+
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            return "Unrecognized keyword at start of statement.";
+
+        case (PREPARE_ID_TOO_LARGE):
+            return "ID is too large.";
+
+    }
+
+    return "Unknown prepare result.";
+
+}
+
+PrepareResult prepare_statement(InputBuffer* input_buffer, 
+                                Statement* statement) {
+
+    PrepareResult result = parse_statement(input_buffer->buffer, 
+                                           input_buffer->input_length, statement);
+
+    // Parameters are only bound through a prepared statement
+    if (result == PREPARE_SUCCESS && statement->num_parameters > 0) {
+        close_statement(statement);
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    return result;
+
+}
+
+int compare_rows_by_id(const void* a, const void* b) {
+
+    uint32_t id_a = ((const Row*)a)->id;
+    uint32_t id_b = ((const Row*)b)->id;
+
+    return (id_a > id_b) - (id_a < id_b);
+
+}
+
+/*
+    Function to insert the rows of a statement. The rows are sorted
+    by key and applied leaf by leaf: one descent finds a leaf and
+    the keys up to its upper bound are inserted into it directly,
+    until a split changes the tree and the next key descends again.
+    A statement with several rows first checks every key, so it
+    inserts all rows or none.
+*/
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+
+    Row* rows = statement->rows_to_insert;
+    uint32_t num_rows = statement->num_rows;
+    uint32_t upper_bound;
+
+    if (num_rows > 1) {
+
+        qsort(rows, num_rows, sizeof(Row), compare_rows_by_id);
+
+        for (uint32_t i = 1; i < num_rows; i++) {
+            if (rows[i].id == rows[i - 1].id) {
+                return EXECUTE_DUPLICATE_KEY;
+            }
+        }
+
+        for (uint32_t i = 0; i < num_rows; ) {
+
+            Cursor* cursor = table_find_bounded(table, rows[i].id, &upper_bound);
+            void* node = get_page(table->pager, cursor->page_num);
+            uint32_t num_cells = *leaf_node_num_cells(node);
+            uint32_t cell_num = cursor->cell_num;
+
+            free(cursor);
+
+            do {
+
+                cell_num += node_key_lower_bound(leaf_node_key(node, cell_num),
+                                                 LEAF_NODE_SLOT_SIZE,
+                                                 num_cells - cell_num,
+                                                 rows[i].id);
+
+                if (cell_num < num_cells && 
+                    *leaf_node_key(node, cell_num) == rows[i].id) {
+                    return EXECUTE_DUPLICATE_KEY;
+                }
+
+                i++;
+
+            } while (i < num_rows && rows[i].id <= upper_bound);
+
+        }
+
+    }
+
+    // Every row copies the path to its leaf, up to the root
+    if (table->cow.enabled) {
+
+        for (uint32_t i = 0; i < num_rows; i++) {
+            if (cow_insert(table, &rows[i]) != EXECUTE_SUCCESS) {
+                return EXECUTE_DUPLICATE_KEY;
+            }
+        }
+
+        index_insert_rows(table, rows, num_rows);
+        return EXECUTE_SUCCESS;
+
+    }
+
+    // The pages of a leaf's rows are released before the next leaf
+    uint32_t pins = pager_pin_mark(table->pager);
+
+    for (uint32_t i = 0; i < num_rows; ) {
+
+        pager_unpin_to(table->pager, pins);
+
+        Cursor* cursor = table_find_bounded(table, rows[i].id, &upper_bound);
+        void* node = get_page(table->pager, cursor->page_num);
+
+        do {
+
+            uint32_t num_cells = *leaf_node_num_cells(node);
+
+            cursor->cell_num += node_key_lower_bound(
+                                    leaf_node_key(node, cursor->cell_num),
+                                    LEAF_NODE_SLOT_SIZE,
+                                    num_cells - cursor->cell_num,
+                                    rows[i].id);
+
+            // The duplicate check reads the leaf the descent ended on
+            if (cursor->cell_num < num_cells && 
+                *leaf_node_key(node, cursor->cell_num) == rows[i].id) {
+                free(cursor);
+                return EXECUTE_DUPLICATE_KEY;
+            }
+
+            bool splits = !leaf_node_has_room(node, 
+                                              serialized_row_size(&rows[i]));
+
+            leaf_node_insert(cursor, rows[i].id, &rows[i]);
+            i++;
+
+            // A split moved cells to another leaf, descend again
+            if (splits) {
+                break;
+            }
+
+            cursor->cell_num += 1;
+
+        } while (i < num_rows && rows[i].id <= upper_bound);
+
+        free(cursor);
+
+    }
+
+    index_insert_rows(table, rows, num_rows);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+/*
+    Bulk loader for the .load command. Builds the tree bottom-up
+    from rows sorted by id, one per line as "<id> <username> <email>".
+    Leaves are filled completely and linked as they are written,
+    then every internal level is packed over the level below. The
+    top node of the new tree, a single leaf or the internal node
+    over the last level, replaces the empty root last, so a load
+    which fails part way leaves the table empty; the leaves it
+    wrote go back on the free list.
+*/
+ExecuteResult bulk_load(Table* table, FILE* input, uint32_t* rows_loaded) {
+
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+
+    if (get_node_type(root) != NODE_LEAF || *leaf_node_num_cells(root) != 0) {
+        pager_commit(pager);
+        return EXECUTE_TABLE_NOT_EMPTY;
+    }
+
+    // Page number and maximum key of every node on the level being built
+    uint32_t level_capacity = 64;
+    uint32_t level_count = 0;
+    uint32_t* level_pages = malloc(level_capacity * sizeof(uint32_t));
+    uint32_t* level_keys = malloc(level_capacity * sizeof(uint32_t));
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    uint32_t leaf_page_num = INVALID_PAGE_NUM;
+    void* leaf = NULL;
+    char* line = NULL;
+    size_t line_length = 0;
+    ssize_t bytes_read;
+    Row row;
+
+    *rows_loaded = 0;
+
+    while ((bytes_read = getline(&line, &line_length, input)) != -1) {
+
+        if (bytes_read > 0 && line[bytes_read - 1] == '\n') {
+            line[bytes_read - 1] = '\0';
+        }
+
+        if (line[strspn(line, " \t\r")] == '\0') {
+            continue;
+        }
+
+        if (parse_row(line, strlen(line), &row) != PREPARE_SUCCESS) {
+            result = EXECUTE_INVALID_ROW;
+            break;
+        }
+
+        if (*rows_loaded > 0 && row.id <= level_keys[level_count - 1]) {
+            result = EXECUTE_UNSORTED_INPUT;
+            break;
+        }
+
+        uint8_t payload[ROW_MAX_SIZE];
+        uint32_t payload_length = serialize_row(&row, payload);
+
+        if (leaf == NULL || !leaf_node_has_room(leaf, payload_length)) {
+
+            uint32_t new_page_num = get_unused_page_num(pager);
+
+            // The full leaf is finished; log it and let it be evicted
+            if (leaf != NULL) {
+
+                *leaf_node_next_leaf(leaf) = new_page_num;
+                pager_commit(pager);
+
+            }
+
+            leaf_page_num = new_page_num;
+            leaf = get_page(pager, leaf_page_num);
+            initialize_leaf_node(leaf);
+            mark_page_dirty(pager, leaf_page_num);
+
+            if (level_count == level_capacity) {
+
+                level_capacity *= 2;
+                level_pages = realloc(level_pages, level_capacity * sizeof(uint32_t));
+                level_keys = realloc(level_keys, level_capacity * sizeof(uint32_t));
+
+            }
+
+            level_pages[level_count++] = leaf_page_num;
+
+        }
+
+        leaf_node_append_cell(leaf, row.id, payload, payload_length);
+
+        level_keys[level_count - 1] = row.id;
+        *rows_loaded += 1;
+
+    }
+
+    free(line);
+
+    if (result != EXECUTE_SUCCESS) {
+
+        for (uint32_t i = 0; i < level_count; i++) {
+            free_page(pager, level_pages[i]);
+        }
+
+    }
+
+    pager_commit(pager);
+
+    if (result != EXECUTE_SUCCESS || level_count == 0) {
+
+        free(level_pages);
+        free(level_keys);
+        return result;
+
+    }
+
+    /*
+        Pack each level into internal nodes of up to 
+        INTERNAL_NODE_MAX_CELLS + 1 children, the last child of
+        each node being its right child. The level above replaces
+        the current one in place, until a single node, the root,
+        is left.
+    */
+
+    uint32_t children_per_node = INTERNAL_NODE_MAX_CELLS + 1;
+
+    while (level_count > 1) {
+
+        uint32_t num_nodes = (level_count + children_per_node - 1) / 
+                             children_per_node;
+
+        for (uint32_t n = 0; n < num_nodes; n++) {
+
+            uint32_t page_num = get_unused_page_num(pager);
+            void* node = get_page(pager, page_num);
+            initialize_internal_node(node);
+
+            uint32_t first = n * children_per_node;
+            uint32_t last = first + children_per_node;
+            if (last > level_count) {
+                last = level_count;
+            }
+
+            for (uint32_t c = first; c < last; c++) {
+
+                set_node_parent(pager, level_pages[c], page_num);
+
+                if (c < last - 1) {
+
+                    *internal_node_cell(node, c - first) = level_pages[c];
+                    *internal_node_key(node, c - first) = level_keys[c];
+
+                }
+
+            }
+
+            *internal_node_num_keys(node) = last - first - 1;
+            *internal_node_right_child(node) = level_pages[last - 1];
+            mark_page_dirty(pager, page_num);
+
+            level_pages[n] = page_num;
+            level_keys[n] = level_keys[last - 1];
+
+            pager_commit(pager);
+
+        }
+
+        level_count = num_nodes;
+
+    }
+
+    /*
+        The top node becomes the root in place of the empty leaf,
+        which is freed; in copy-on-write mode it is retired, and the
+        caller publishes the new tree
+    */
+    uint32_t old_root_page_num = table->root_page_num;
+    table->root_page_num = level_pages[0];
+    set_node_root(get_page(pager, table->root_page_num), true);
+    mark_page_dirty(pager, table->root_page_num);
+
+    if (table->cow.enabled) {
+
+        cow_mark_written(table, table->root_page_num);
+        cow_retire(table, old_root_page_num);
+
+    }
+    else {
+
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_root_page(header) = table->root_page_num;
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        free_page(pager, old_root_page_num);
+
+    }
+
+    pager_commit(pager);
+
+    // Indexes created on the empty table are filled from the new rows
+    for (Column column = COLUMN_USERNAME; column <= COLUMN_EMAIL; column++) {
+
+        uint32_t index_root_page_num = 
+                *db_header_index_root(get_page(pager, DB_HEADER_PAGE_NUM), column);
+
+        if (index_root_page_num == INVALID_PAGE_NUM) {
+            continue;
+        }
+
+        index_build(table, &index_root_page_num, column);
+
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_index_root(header, column) = index_root_page_num;
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        pager_commit(pager);
+
+    }
+
+    free(level_pages);
+    free(level_keys);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+/*
+    Result sink. The rows of a select are formatted into one large
+    buffer, which is written out when it fills up and at the end
+    of the statement, instead of going through printf per row.
+    Formats:
+        text    ( 1, name, mail )
+        csv     1,name,mail with a header line, quoted when needed
+        tsv     1<TAB>name<TAB>mail with a header line
+        binary  per row a uint16_t length, then the id as a uint32_t 
+                and each string as a one byte length and its bytes;
+                a zero length ends the result
+*/
+
+// Worst case row: every column an email quoted with every character doubled
+const uint32_t OUTPUT_MAX_ROW_SIZE = 
+                MAX_SELECT_COLUMNS * (2 * COLUMN_EMAIL_SIZE + 4) + 8;
+
+const char* COLUMN_NAMES[] = { "id", "username", "email" };
+const char* AGGREGATE_NAMES[] = { "count(*)", "min(id)", "max(id)" };
+
+void sink_flush(ResultSink* sink) {
+
+    // A sink without a file is read by its owner
+    if (sink->file_descriptor == -1) {
+        return;
+    }
+
+    // Text printed through stdio so far goes out first
+    fflush(stdout);
+
+    uint32_t written = 0;
+
+    while (written < sink->length) {
+
+        ssize_t bytes_written = write(sink->file_descriptor, 
+                                      sink->buffer + written,
+                                      sink->length - written);
+
+        if (bytes_written == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Error writing output: %d\n", errno);
+            exit(EXIT_FAILURE);
+
+        }
+
+        written += bytes_written;
+
+    }
+
+    sink->length = 0;
+
+}
+
+void sink_reserve(ResultSink* sink, uint32_t bytes) {
+
+    if (sink->length + bytes <= sink->capacity) {
+        return;
+    }
+
+    // A sink without a file keeps the whole result, so it grows
+    if (sink->file_descriptor == -1) {
+
+        while (sink->length + bytes > sink->capacity) {
+            sink->capacity *= 2;
+        }
+        sink->buffer = realloc(sink->buffer, sink->capacity);
+        return;
+
+    }
+
+    sink_flush(sink);
+
+}
+
+void sink_write(ResultSink* sink, const void* data, uint32_t length) {
+
+    memcpy(sink->buffer + sink->length, data, length);
+    sink->length += length;
+
+}
+
+/*
+    Decimal formatting of an id, digits are produced backwards
+*/
+void sink_write_uint(ResultSink* sink, uint32_t value) {
+
+    char digits[10];
+    uint32_t count = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0) {
+        sink->buffer[sink->length++] = digits[--count];
+    }
+
+}
+
+void sink_write_string(ResultSink* sink, const char* string, uint8_t length) {
+
+    if (sink->format == OUTPUT_BINARY) {
+
+        sink->buffer[sink->length++] = length;
+        sink_write(sink, string, length);
+        return;
+
+    }
+
+    bool quote = false;
+
+    if (sink->format == OUTPUT_CSV) {
+        for (uint32_t i = 0; i < length && !quote; i++) {
+            quote = string[i] == ',' || string[i] == '"' || 
+                    string[i] == '\n' || string[i] == '\r';
+        }
+    }
+
+    if (!quote) {
+        sink_write(sink, string, length);
+        return;
+    }
+
+    sink->buffer[sink->length++] = '"';
+    for (uint32_t i = 0; i < length; i++) {
+
+        if (string[i] == '"') {
+            sink->buffer[sink->length++] = '"';
+        }
+        sink->buffer[sink->length++] = string[i];
+
+    }
+    sink->buffer[sink->length++] = '"';
+
+}
+
+/*
+    Function to start the result of a select, CSV and TSV begin 
+    with a header line of column names
+*/
+void sink_begin_names(ResultSink* sink, const char** names, uint32_t num_names) {
+
+    if (sink->format != OUTPUT_CSV && sink->format != OUTPUT_TSV) {
+        return;
+    }
+
+    sink_reserve(sink, OUTPUT_MAX_ROW_SIZE);
+
+    for (uint32_t i = 0; i < num_names; i++) {
+
+        if (i > 0) {
+            sink->buffer[sink->length++] = sink->format == OUTPUT_CSV ? ',' : '\t';
+        }
+        sink_write(sink, names[i], strlen(names[i]));
+
+    }
+
+    sink->buffer[sink->length++] = '\n';
+
+}
+
+void sink_begin(ResultSink* sink, const Column* columns, uint32_t num_columns) {
+
+    const char* names[MAX_SELECT_COLUMNS];
+
+    for (uint32_t i = 0; i < num_columns; i++) {
+        names[i] = COLUMN_NAMES[columns[i]];
+    }
+
+    sink_begin_names(sink, names, num_columns);
+
+}
+
+void sink_write_separator(ResultSink* sink) {
+
+    switch (sink->format) {
+        case (OUTPUT_TEXT):
+            sink_write(sink, ", ", 2);
+            break;
+        case (OUTPUT_CSV):
+            sink->buffer[sink->length++] = ',';
+            break;
+        case (OUTPUT_TSV):
+            sink->buffer[sink->length++] = '\t';
+            break;
+        case (OUTPUT_BINARY):
+            break;
+    }
+
+}
+
+/*
+    Function to format the selected columns of a row. The id comes
+    from the leaf slot and the strings are read straight out of 
+    the serialized row, so no Row is materialized
+*/
+void sink_write_row(ResultSink* sink, uint32_t key, void* value,
+                    const Column* columns, uint32_t num_columns) {
+
+    sink_reserve(sink, OUTPUT_MAX_ROW_SIZE);
+
+    uint32_t row_start = sink->length;
+    uint8_t length;
+    char* string;
+
+    if (sink->format == OUTPUT_BINARY) {
+        sink->length += sizeof(uint16_t);
+    }
+    else if (sink->format == OUTPUT_TEXT) {
+        sink_write(sink, "( ", 2);
+    }
+
+    for (uint32_t i = 0; i < num_columns; i++) {
+
+        if (i > 0) {
+            sink_write_separator(sink);
+        }
+
+        switch (columns[i]) {
+            case (COLUMN_ID):
+                if (sink->format == OUTPUT_BINARY) {
+                    sink_write(sink, &key, sizeof(key));
+                }
+                else {
+                    sink_write_uint(sink, key);
+                }
+                break;
+            case (COLUMN_USERNAME):
+                string = row_username(value, &length);
+                sink_write_string(sink, string, length);
+                break;
+            case (COLUMN_EMAIL):
+                string = row_email(value, &length);
+                sink_write_string(sink, string, length);
+                break;
+        }
+
+    }
+
+    if (sink->format == OUTPUT_BINARY) {
+
+        uint16_t row_length = sink->length - row_start - sizeof(uint16_t);
+        memcpy(sink->buffer + row_start, &row_length, sizeof(row_length));
+
+    }
+    else if (sink->format == OUTPUT_TEXT) {
+        sink_write(sink, " )\n", 3);
+    }
+    else {
+        sink->buffer[sink->length++] = '\n';
+    }
+
+}
+
+/*
+    Function to format the row of the aggregates of a select. The
+    minimum and maximum of no rows are NULL, which is printed as
+    NULL in text, left empty in CSV and TSV, and written as
+    UINT32_MAX in the binary format
+*/
+void sink_write_aggregates(ResultSink* sink, Aggregates* aggregates,
+                           const Aggregate* selected, uint32_t num_selected) {
+
+    sink_reserve(sink, OUTPUT_MAX_ROW_SIZE);
+
+    uint32_t row_start = sink->length;
+
+    if (sink->format == OUTPUT_BINARY) {
+        sink->length += sizeof(uint16_t);
+    }
+    else if (sink->format == OUTPUT_TEXT) {
+        sink_write(sink, "( ", 2);
+    }
+
+    for (uint32_t i = 0; i < num_selected; i++) {
+
+        uint32_t value = aggregates->count;
+        bool is_null = false;
+
+        if (selected[i] != AGGREGATE_COUNT) {
+            value = (selected[i] == AGGREGATE_MIN_ID) ? aggregates->min_id 
+                                                      : aggregates->max_id;
+            is_null = aggregates->count == 0;
+        }
+
+        if (i > 0) {
+            sink_write_separator(sink);
+        }
+
+        if (sink->format == OUTPUT_BINARY) {
+
+            value = is_null ? UINT32_MAX : value;
+            sink_write(sink, &value, sizeof(value));
+
+        }
+        else if (is_null) {
+
+            if (sink->format == OUTPUT_TEXT) {
+                sink_write(sink, "NULL", 4);
+            }
+
+        }
+        else {
+            sink_write_uint(sink, value);
+        }
+
+    }
+
+    if (sink->format == OUTPUT_BINARY) {
+
+        uint16_t row_length = sink->length - row_start - sizeof(uint16_t);
+        memcpy(sink->buffer + row_start, &row_length, sizeof(row_length));
+
+    }
+    else if (sink->format == OUTPUT_TEXT) {
+        sink_write(sink, " )\n", 3);
+    }
+    else {
+        sink->buffer[sink->length++] = '\n';
+    }
+
+}
+
+void sink_end(ResultSink* sink) {
+
+    if (sink->format == OUTPUT_BINARY) {
+
+        uint16_t end_marker = 0;
+
+        sink_reserve(sink, sizeof(end_marker));
+        sink_write(sink, &end_marker, sizeof(end_marker));
+
+    }
+
+    sink_flush(sink);
+
+}
+
+/*
+    Function to copy the result kept by another sink into a sink
+*/
+void sink_append(ResultSink* sink, ResultSink* source) {
+
+    uint32_t written = 0;
+
+    while (written < source->length) {
+
+        uint32_t length = source->length - written;
+        if (length > sink->capacity) {
+            length = sink->capacity;
+        }
+
+        sink_reserve(sink, length);
+        sink_write(sink, source->buffer + written, length);
+        written += length;
+
+    }
+
+}
+
+/*
+    Function to delete the rows with ids between the bounds of the
+    statement. Each row is found again from the next id after a 
+    delete, since merges may move the following rows to another leaf,
+    so the pages of a row are released once it is deleted
+*/
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+
+    uint32_t key = statement->where_low;
+    uint32_t pins = pager_pin_mark(table->pager);
+    Row row;
+
+    while (true) {
+
+        pager_unpin_to(table->pager, pins);
+
+        Cursor* cursor = table_seek(table, key);
+
+        if (cursor->end_of_table || cursor_key(cursor) > statement->where_high) {
+            free(cursor);
+            break;
+        }
+
+        deserialize_row(cursor_value(cursor), &row);
+        index_delete_row(table, &row);
+
+        if (table->cow.enabled) {
+            cow_delete(table, row.id);
+        }
+        else {
+            leaf_node_delete(cursor);
+        }
+        free(cursor);
+
+        if (row.id == statement->where_high) {
+            break;
+        }
+        key = row.id + 1;
+
+    }
+
+    return EXECUTE_SUCCESS;
+
+}
+
+/*
+    Function to create the index on a column, built from the rows
+    already in the table
+*/
+ExecuteResult execute_create_index(Statement* statement, Table* table) {
+
+    Pager* pager = table->pager;
+    Column column = statement->index_column;
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+
+    if (*db_header_index_root(header, column) != INVALID_PAGE_NUM) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page(pager, root_page_num);
+
+    initialize_index_node(root, NODE_INDEX_LEAF);
+    mark_page_dirty(pager, root_page_num);
+
+    index_build(table, &root_page_num, column);
+
+    header = get_page(pager, DB_HEADER_PAGE_NUM);
+    *db_header_index_root(header, column) = root_page_num;
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+/*
+    Functions to compute aggregates over the ids of matching rows
+*/
+void aggregates_init(Aggregates* aggregates) {
+
+    aggregates->count = 0;
+    aggregates->min_id = UINT32_MAX;
+    aggregates->max_id = 0;
+
+}
+
+void aggregates_add(Aggregates* aggregates, uint32_t key) {
+
+    aggregates->count += 1;
+    if (key < aggregates->min_id) {
+        aggregates->min_id = key;
+    }
+    if (key > aggregates->max_id) {
+        aggregates->max_id = key;
+    }
+
+}
+
+void aggregates_merge(Aggregates* aggregates, Aggregates* partial) {
+
+    aggregates->count += partial->count;
+    if (partial->min_id < aggregates->min_id) {
+        aggregates->min_id = partial->min_id;
+    }
+    if (partial->max_id > aggregates->max_id) {
+        aggregates->max_id = partial->max_id;
+    }
+
+}
+
+/*
+    Function for whether a row scanned by a select passes its where
+    clause
+*/
+bool row_matches_where(Statement* statement, uint32_t key, void* value) {
+
+    uint8_t length;
+    char* string;
+
+    switch (statement->where_type) {
+
+        case (WHERE_ID_BETWEEN):
+            return key >= statement->where_low && key <= statement->where_high;
+
+        case (WHERE_COLUMN_EQUALS):
+            string = (statement->where_column == COLUMN_USERNAME)
+                     ? row_username(value, &length)
+                     : row_email(value, &length);
+            return length == strlen(statement->where_value) &&
+                   memcmp(string, statement->where_value, length) == 0;
+
+        default:
+            return true;
+
+    }
+
+}
+
+/*
+    Function to divide the keys from `low` to `high` into ranges for
+    a parallel scan. The separator keys of internal nodes are taken
+    level by level from the root, skipping subtrees outside the
+    bounds. While the keys found so far fit into `max_keys` the next
+    level is read; otherwise `max_keys` evenly spaced keys of them
+    are taken, so the ranges span about as many leaves each. Returns 
+    the number of keys written to `keys`, in ascending order; range i 
+    ends at key i
+*/
+uint32_t table_partition(Table* table, uint32_t low, uint32_t high,
+                         uint32_t* keys, uint32_t max_keys) {
+
+    Pager* pager = table->pager;
+
+    // The nodes of a level are at most one more than the keys above it
+    uint32_t* level = malloc((max_keys + 1) * sizeof(uint32_t));
+    uint32_t num_nodes = 1;
+    uint32_t* children = NULL;
+    uint32_t children_capacity = 0;
+    uint32_t* found = malloc(max_keys * sizeof(uint32_t));
+    uint32_t found_capacity = max_keys;
+    uint32_t num_found = 0;
+    uint32_t num_keys = 0;
+
+    level[0] = table->root_page_num;
+
+    while (num_found <= max_keys) {
+
+        // Keys found so far all fit, and divide the range further
+        memcpy(keys, found, num_found * sizeof(uint32_t));
+        num_keys = num_found;
+
+        // The nodes after a leaf are all leaves
+        if (num_nodes == 0 ||
+            get_node_type(get_page_unpinned(pager, level[0])) != NODE_INTERNAL) {
+            break;
+        }
+
+        uint32_t num_children = 0;
+
+        for (uint32_t n = 0; n < num_nodes; n++) {
+
+            void* node = get_page_unpinned(pager, level[n]);
+            uint32_t node_keys = *internal_node_num_keys(node);
+
+            if (num_children + node_keys + 1 > children_capacity) {
+                children_capacity = 2 * (num_children + node_keys + 1);
+                children = realloc(children, children_capacity * sizeof(uint32_t));
+            }
+
+            if (num_found + node_keys > found_capacity) {
+                found_capacity = 2 * (num_found + node_keys);
+                found = realloc(found, found_capacity * sizeof(uint32_t));
+            }
+
+            for (uint32_t i = 0; i <= node_keys; i++) {
+
+                // Child i holds the keys after key i - 1, up to key i
+                bool above_low = (i == node_keys || *internal_node_key(node, i) >= low);
+                bool below_high = (i == 0 || *internal_node_key(node, i - 1) < high);
+
+                if (!above_low || !below_high) {
+                    continue;
+                }
+
+                if (i < node_keys && *internal_node_key(node, i) < high) {
+                    found[num_found++] = *internal_node_key(node, i);
+                }
+
+                children[num_children++] = *internal_node_child(node, i);
+
+            }
+
+        }
+
+        if (num_found <= max_keys) {
+            memcpy(level, children, num_children * sizeof(uint32_t));
+            num_nodes = num_children;
+        }
+
+    }
+
+    qsort(keys, num_keys, sizeof(uint32_t), compare_keys);
+
+    // Too many keys on the last level read, take every so many of them
+    if (num_found > max_keys) {
+
+        qsort(found, num_found, sizeof(uint32_t), compare_keys);
+
+        for (uint32_t i = 0; i < max_keys; i++) {
+            keys[i] = found[(uint64_t)(i + 1) * num_found / (max_keys + 1)];
+        }
+
+        num_keys = max_keys;
+
+    }
+
+    free(level);
+    free(children);
+    free(found);
+
+    return num_keys;
+
+}
+
+/*
+    Function for the next range of a scan thread. Each thread owns
+    every num_workers-th range, so all of them start next to the
+    ranges being written out. A thread takes the first of its own
+    ranges, otherwise the first range of another thread, as long as
+    it lies in the window; when neither does, it waits for the
+    calling thread to write out a range. Returns UINT32_MAX when 
+    every range is taken
+*/
+uint32_t scan_worker_next_range(ScanWorker* worker) {
+
+    ParallelScan* scan = worker->scan;
+    uint32_t worker_num = worker - scan->workers;
+
+    while (true) {
+
+        pthread_mutex_lock(&scan->lock);
+        uint32_t written = scan->written;
+        pthread_mutex_unlock(&scan->lock);
+
+        bool ranges_left = false;
+
+        for (uint32_t i = 0; i < scan->num_workers; i++) {
+
+            uint32_t victim_num = (worker_num + i) % scan->num_workers;
+            ScanWorker* victim = &scan->workers[victim_num];
+            uint32_t range_num = UINT32_MAX;
+
+            pthread_mutex_lock(&victim->lock);
+
+            if (victim->head < victim->tail) {
+
+                ranges_left = true;
+                uint32_t next = victim_num + victim->head * scan->num_workers;
+
+                if (next < written + scan->window) {
+                    range_num = next;
+                    victim->head++;
+                }
+
+            }
+
+            pthread_mutex_unlock(&victim->lock);
+
+            if (range_num != UINT32_MAX) {
+                return range_num;
+            }
+
+        }
+
+        if (!ranges_left) {
+            return UINT32_MAX;
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        while (scan->written == written) {
+            pthread_cond_wait(&scan->range_written, &scan->lock);
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+    }
+
+}
+
+/*
+    Function to scan one range of a parallel scan into its sink.
+    The statement holds the tree latch, so the range is read with
+    the page latches only
+*/
+void scan_range(ParallelScan* scan, ScanRange* range) {
+
+    Table* table = scan->table;
+    Cursor* cursor = table_find_latched(table, range->low, LATCH_READ);
+
+    // Only the ranges in the window hold a buffer
+    if (scan->aggregates == NULL) {
+        range->sink.buffer = malloc(SCAN_RANGE_BUFFER_SIZE);
+        range->sink.capacity = SCAN_RANGE_BUFFER_SIZE;
+    }
+
+    cursor_follow_next_leaf(cursor);
+
+    while (!cursor->end_of_table) {
+
+        uint32_t key = cursor_key(cursor);
+        void* value = cursor_value(cursor);
+
+        if (key > range->high) {
+            break;
+        }
+
+        if (!row_matches_where(scan->statement, key, value)) {
+            cursor_advance(cursor);
+            continue;
+        }
+
+        if (scan->aggregates != NULL) {
+            aggregates_add(&range->aggregates, key);
+        }
+        else {
+            sink_write_row(&range->sink, key, value, 
+                           scan->columns, scan->num_columns);
+        }
+
+        cursor_advance(cursor);
+
+    }
+
+    pager_unfix_page(table->pager, &cursor->leaf);
+    free(cursor);
+
+}
+
+void* scan_worker(void* argument) {
+
+    ScanWorker* worker = argument;
+    ParallelScan* scan = worker->scan;
+    uint32_t range_num;
+
+    while ((range_num = scan_worker_next_range(worker)) != UINT32_MAX) {
+
+        scan_range(scan, &scan->ranges[range_num]);
+
+        pthread_mutex_lock(&scan->lock);
+        scan->ranges[range_num].done = true;
+        pthread_cond_broadcast(&scan->range_done);
+        pthread_mutex_unlock(&scan->lock);
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Function to run a select which scans the table on several
+    threads. The key space is divided into ranges at the separator
+    keys near the root, and each thread starts with its share of
+    ranges, taking those of the others when it runs out. Every range
+    is formatted into a sink of its own, and the calling thread
+    writes them out in key order as they are done; the threads stay
+    within a window of SCAN_WINDOW_PER_THREAD ranges per thread
+    ahead of it. For an aggregate select each range keeps partial
+    aggregates instead, which are merged into `aggregates`. Returns
+    false, without writing anything, when only one scan thread is
+    configured or the scan covers too few leaves to divide.
+*/
+bool select_parallel(Statement* statement, Table* table,
+                     const Column* columns, uint32_t num_columns,
+                     Aggregates* aggregates) {
+
+    Pager* pager = table->pager;
+    uint32_t num_workers = table->scan_threads;
+    uint32_t low = 0;
+    uint32_t high = UINT32_MAX;
+
+    if (statement->where_type == WHERE_ID_BETWEEN) {
+        low = statement->where_low;
+        high = statement->where_high;
+    }
+
+    if (num_workers < 2 || 
+        get_node_type(get_page_unpinned(pager, table->root_page_num)) != NODE_INTERNAL) {
+        return false;
+    }
+
+    uint32_t max_keys = num_workers * SCAN_RANGES_PER_THREAD;
+    uint32_t* keys = malloc(max_keys * sizeof(uint32_t));
+    uint32_t num_keys = table_partition(table, low, high, keys, max_keys);
+
+    // A scan of a few leaves is not worth starting threads for
+    if (num_keys + 1 < 2 * num_workers) {
+        free(keys);
+        return false;
+    }
+
+    ParallelScan scan;
+    scan.table = table;
+    scan.statement = statement;
+    scan.columns = columns;
+    scan.num_columns = num_columns;
+    scan.aggregates = aggregates;
+    scan.num_ranges = num_keys + 1;
+    scan.ranges = malloc(scan.num_ranges * sizeof(ScanRange));
+    scan.written = 0;
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.range_done, NULL);
+    pthread_cond_init(&scan.range_written, NULL);
+
+    for (uint32_t i = 0; i < scan.num_ranges; i++) {
+
+        ScanRange* range = &scan.ranges[i];
+        range->low = (i == 0) ? low : keys[i - 1] + 1;
+        range->high = (i == num_keys) ? high : keys[i];
+        range->done = false;
+        range->sink.format = table->sink.format;
+        range->sink.file_descriptor = -1;
+        range->sink.buffer = NULL;
+        range->sink.length = 0;
+        range->sink.capacity = 0;
+        aggregates_init(&range->aggregates);
+
+    }
+
+    free(keys);
+
+    if (num_workers > scan.num_ranges) {
+        num_workers = scan.num_ranges;
+    }
+
+    scan.num_workers = num_workers;
+    scan.window = num_workers * SCAN_WINDOW_PER_THREAD;
+    scan.workers = malloc(num_workers * sizeof(ScanWorker));
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+
+        ScanWorker* worker = &scan.workers[i];
+        worker->scan = &scan;
+        worker->head = 0;
+        worker->tail = (scan.num_ranges - i + num_workers - 1) / num_workers;
+        pthread_mutex_init(&worker->lock, NULL);
+
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        pthread_create(&scan.workers[i].thread, NULL, scan_worker, &scan.workers[i]);
+    }
+
+    for (uint32_t i = 0; i < scan.num_ranges; i++) {
+
+        ScanRange* range = &scan.ranges[i];
+
+        pthread_mutex_lock(&scan.lock);
+        while (!range->done) {
+            pthread_cond_wait(&scan.range_done, &scan.lock);
+        }
+        pthread_mutex_unlock(&scan.lock);
+
+        if (aggregates != NULL) {
+            aggregates_merge(aggregates, &range->aggregates);
+        }
+        else {
+            sink_append(&table->sink, &range->sink);
+        }
+        free(range->sink.buffer);
+
+        pthread_mutex_lock(&scan.lock);
+        scan.written = i + 1;
+        pthread_cond_broadcast(&scan.range_written);
+        pthread_mutex_unlock(&scan.lock);
+
+    }
+
+    // Threads still look for ranges to steal until they are all joined
+    for (uint32_t i = 0; i < num_workers; i++) {
+        pthread_join(scan.workers[i].thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        pthread_mutex_destroy(&scan.workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.range_done);
+    pthread_cond_destroy(&scan.range_written);
+    free(scan.workers);
+    free(scan.ranges);
+
+    return true;
+
+}
+
+/*
+    Function to select the rows whose string column equals the value
+    of the where clause. With an index on the column the matching
+    ids are read from the index and each row is looked up by id,
+    otherwise the whole table is scanned
+*/
+void select_column_equals(Statement* statement, Table* table, 
+                          const Column* columns, uint32_t num_columns,
+                          Aggregates* aggregates) {
+
+    ResultSink* sink = &(table->sink);
+    Column column = statement->where_column;
+    const char* value = statement->where_value;
+    uint32_t value_length = strlen(value);
+    uint32_t index_root_page_num = 
+            *db_header_index_root(get_page(table->pager, DB_HEADER_PAGE_NUM), column);
+
+    if (index_root_page_num == INVALID_PAGE_NUM) {
+
+        if (select_parallel(statement, table, columns, num_columns, aggregates)) {
+            return;
+        }
+
+        Cursor* cursor = table_start(table);
+
+        while (!cursor->end_of_table) {
+
+            uint32_t key = cursor_key(cursor);
+            void* row_value = cursor_value(cursor);
+            uint8_t length;
+            char* string = (column == COLUMN_USERNAME) 
+                           ? row_username(row_value, &length)
+                           : row_email(row_value, &length);
+
+            if (length != value_length || memcmp(string, value, length) != 0) {
+                cursor_advance(cursor);
+                continue;
+            }
+
+            if (aggregates != NULL) {
+                aggregates_add(aggregates, key);
+            }
+            else {
+                sink_write_row(sink, key, row_value, columns, num_columns);
+            }
+
+            cursor_advance(cursor);
+
+        }
+
+        free(cursor);
+        return;
+
+    }
+
+    Cursor* index_cursor = index_seek(table, index_root_page_num, 
+                                      value, value_length);
+
+    while (!index_cursor->end_of_table) {
+
+        void* node = get_page_unpinned(table->pager, index_cursor->page_num);
+        void* entry = leaf_node_value(node, index_cursor->cell_num);
+        uint32_t entry_length = *leaf_node_cell_length(node, index_cursor->cell_num);
+        uint32_t id = *leaf_node_key(node, index_cursor->cell_num);
+
+        if (entry_length - ID_SIZE != value_length ||
+            memcmp(entry + ID_SIZE, value, value_length) != 0) {
+            break;
+        }
+
+        // Aggregates only need the ids, which the index holds
+        if (aggregates != NULL) {
+            aggregates_add(aggregates, id);
+            cursor_advance(index_cursor);
+            continue;
+        }
+
+        Cursor* cursor = table_find(table, id);
+
+        sink_write_row(sink, cursor_key(cursor), cursor_value(cursor), 
+                       columns, num_columns);
+
+        free(cursor);
+        cursor_advance(index_cursor);
+
+    }
+
+    free(index_cursor);
+
+}
+
+/*
+    Function to look up the rows of a point lookup. The ids are 
+    sorted, so a descent serves every id up to the largest key its
+    leaf covers, and each is searched from the cell of the previous
+    one, like the rows of a multi-row insert
+*/
+void select_ids(Statement* statement, Table* table, 
+                const Column* columns, uint32_t num_columns,
+                Aggregates* aggregates) {
+
+    ResultSink* sink = &(table->sink);
+    uint32_t* ids = statement->where_ids;
+    uint32_t num_ids = statement->num_where_ids;
+    uint32_t upper_bound;
+
+    for (uint32_t i = 0; i < num_ids; ) {
+
+        Cursor* cursor = table_find_bounded(table, ids[i], &upper_bound);
+        void* node = get_page(table->pager, cursor->page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t cell_num = cursor->cell_num;
+
+        free(cursor);
+
+        do {
+
+            cell_num += node_key_lower_bound(leaf_node_key(node, cell_num),
+                                             LEAF_NODE_SLOT_SIZE,
+                                             num_cells - cell_num, ids[i]);
+
+            if (cell_num < num_cells && *leaf_node_key(node, cell_num) == ids[i]) {
+
+                if (aggregates != NULL) {
+                    aggregates_add(aggregates, ids[i]);
+                }
+                else {
+                    sink_write_row(sink, ids[i], leaf_node_value(node, cell_num),
+                                   columns, num_columns);
+                }
+
+            }
+
+            i++;
+
+        } while (i < num_ids && ids[i] <= upper_bound);
+
+    }
+
+}
+
+/*
+    Function to count the rows with keys from `low` to `high` under
+    a node. Subtrees entirely within the bounds are counted from the
+    cell counts in their leaf headers, and in the two leaves at the
+    bounds the keys are searched; no row is read
+*/
+uint32_t subtree_count(Pager* pager, uint32_t page_num, uint32_t low, uint32_t high) {
+
+    void* node = get_page_unpinned(pager, page_num);
+
+    if (get_node_type(node) == NODE_LEAF) {
+
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t first = node_key_lower_bound(leaf_node_key(node, 0),
+                                              LEAF_NODE_SLOT_SIZE, num_cells, low);
+        uint32_t last = num_cells;
+
+        if (high < UINT32_MAX) {
+            last = node_key_lower_bound(leaf_node_key(node, 0),
+                                        LEAF_NODE_SLOT_SIZE, num_cells, high + 1);
+        }
+
+        return last > first ? last - first : 0;
+
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i <= num_keys; i++) {
+
+        // The children before may have evicted the node
+        node = get_page_unpinned(pager, page_num);
+
+        // Child i holds the keys after key i - 1, up to key i
+        uint32_t child_low = (i == 0) ? 0 : *internal_node_key(node, i - 1) + 1;
+        uint32_t child_high = (i == num_keys) ? UINT32_MAX 
+                                              : *internal_node_key(node, i);
+        uint32_t child_page_num = *internal_node_child(node, i);
+
+        if (child_high < low || child_low > high) {
+            continue;
+        }
+
+        if (child_low >= low && child_high <= high) {
+            count += subtree_count(pager, child_page_num, 0, UINT32_MAX);
+        }
+        else {
+            count += subtree_count(pager, child_page_num, low, high);
+        }
+
+    }
+
+    return count;
+
+}
+
+/*
+    Function for the largest key <= `high` under a node. Without an
+    upper bound this is a single descent along the right children;
+    otherwise a left sibling is only tried when the child covering
+    `high` holds no smaller key
+*/
+bool subtree_max_key(Pager* pager, uint32_t page_num, uint32_t high, uint32_t* key) {
+
+    void* node = get_page_unpinned(pager, page_num);
+
+    if (get_node_type(node) == NODE_LEAF) {
+
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t cell_num = node_key_lower_bound(leaf_node_key(node, 0),
+                                                 LEAF_NODE_SLOT_SIZE, 
+                                                 num_cells, high);
+
+        if (cell_num < num_cells && *leaf_node_key(node, cell_num) == high) {
+            *key = high;
+            return true;
+        }
+        if (cell_num == 0) {
+            return false;
+        }
+
+        *key = *leaf_node_key(node, cell_num - 1);
+        return true;
+
+    }
+
+    for (uint32_t i = internal_node_find_child(node, high) + 1; i > 0; i--) {
+
+        node = get_page_unpinned(pager, page_num);
+
+        if (subtree_max_key(pager, *internal_node_child(node, i - 1), high, key)) {
+            return true;
+        }
+
+    }
+
+    return false;
+
+}
+
+/*
+    Function to compute the aggregates of a select. On the whole
+    table or an id range they are pushed down into the tree: 
+    count(*) sums the cell counts of the leaves, min(id) is the
+    first key of a seek and max(id) comes from a single descent.
+    A filter on a string column reads the matching ids from its 
+    index, or scans the table, and an id list is looked up.
+*/
+ExecuteResult select_aggregates(Statement* statement, Table* table) {
+
+    ResultSink* sink = &(table->sink);
+    Pager* pager = table->pager;
+    const char* names[MAX_SELECT_COLUMNS];
+    Aggregates aggregates;
+    uint32_t low = 0;
+    uint32_t high = UINT32_MAX;
+
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+        names[i] = AGGREGATE_NAMES[statement->aggregates[i]];
+    }
+
+    sink_begin_names(sink, names, statement->num_aggregates);
+    aggregates_init(&aggregates);
+
+    if (statement->where_type == WHERE_ID_BETWEEN) {
+        low = statement->where_low;
+        high = statement->where_high;
+    }
+
+    if (statement->where_type == WHERE_COLUMN_EQUALS) {
+        select_column_equals(statement, table, NULL, 0, &aggregates);
+    }
+    else if (statement->where_type == WHERE_ID_IN) {
+        select_ids(statement, table, NULL, 0, &aggregates);
+    }
+    else if (low <= high) {
+
+        aggregates.count = subtree_count(pager, table->root_page_num, low, high);
+
+        if (aggregates.count > 0) {
+
+            Cursor* cursor = table_seek(table, low);
+            aggregates.min_id = cursor_key(cursor);
+            free(cursor);
+
+            subtree_max_key(pager, table->root_page_num, high, &aggregates.max_id);
+
+        }
+
+    }
+
+    sink_write_aggregates(sink, &aggregates, statement->aggregates, 
+                          statement->num_aggregates);
+    sink_end(sink);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+const Column ALL_COLUMNS[] = { COLUMN_ID, COLUMN_USERNAME, COLUMN_EMAIL };
+
+ExecuteResult execute_select(Statement* statement, Table* table) {
+
+    ResultSink* sink = &(table->sink);
+    const Column* columns = statement->columns;
+    uint32_t num_columns = statement->num_columns;
+    Cursor* cursor;
+
+    if (statement->num_aggregates > 0) {
+        return select_aggregates(statement, table);
+    }
+
+    if (num_columns == 0) {
+        columns = ALL_COLUMNS;
+        num_columns = MAX_SELECT_COLUMNS;
+    }
+
+    sink_begin(sink, columns, num_columns);
+
+    if (statement->where_type == WHERE_COLUMN_EQUALS) {
+
+        select_column_equals(statement, table, columns, num_columns, NULL);
+        sink_end(sink);
+        return EXECUTE_SUCCESS;
+
+    }
+
+    if (statement->where_type == WHERE_ID_IN) {
+
+        select_ids(statement, table, columns, num_columns, NULL);
+        sink_end(sink);
+        return EXECUTE_SUCCESS;
+
+    }
+
+    if (select_parallel(statement, table, columns, num_columns, NULL)) {
+        sink_end(sink);
+        return EXECUTE_SUCCESS;
+    }
+
+    /*
+        A range scan seeks to its first key once, then streams
+        along the leaf chain until it passes the upper bound
+    */
+    if (statement->where_type == WHERE_ID_BETWEEN) {
+        cursor = table_seek(table, statement->where_low);
+    }
+    else {
+        cursor = table_start(table);
+    }
+
+    while (!cursor->end_of_table) {
+
+        uint32_t key = cursor_key(cursor);
+
+        if (statement->where_type == WHERE_ID_BETWEEN &&
+            key > statement->where_high) {
+            break;
+        }
+
+        sink_write_row(sink, key, cursor_value(cursor), columns, num_columns);
+        cursor_advance(cursor);
+
+    }
+
+    sink_end(sink);
+    free(cursor);
+
+    return EXECUTE_SUCCESS;
+
+}
+
+ExecuteResult execute_statement(Statement* statement, Table* table) {
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+
+    tree_latch_acquire(table, LATCH_WRITE);
+
+    switch(statement->type) {
+
+        case (STATEMENT_INSERT):
+            result = execute_insert(statement, table);
+            break;
+
+        case (STATEMENT_SELECT):
+            result = execute_select(statement, table);
+            break;
+
+        case (STATEMENT_DELETE):
+            result = execute_delete(statement, table);
+            break;
+
+        case (STATEMENT_CREATE_INDEX):
+            result = execute_create_index(statement, table);
+            break;
+    }
+
+    cow_publish(table);
+
+    // Log the statement's pages, then they may be evicted again
+    pager_commit(table->pager);
+
+    tree_latch_release(table);
+
+    return result;
+
+}
+
+/*
+    Function to make the statements executed so far durable. They
+    are logged when they finish, but the log is synced once per
+    group of statements, so a caller syncs before it acknowledges
+    one. Without the log, statements reach the db file on close.
+*/
+void db_sync(Table* table) {
+
+    Pager* pager = table->pager;
+
+    if (!pager->wal_enabled) {
+        return;
+    }
+
+    tree_latch_acquire(table, LATCH_READ);
+    pthread_mutex_lock(&pager->wal_lock);
+    wal_sync(pager);
+    pthread_mutex_unlock(&pager->wal_lock);
+    tree_latch_release(table);
+
+}
+
+const char* execute_result_message(ExecuteResult result) {
+
+    switch (result) {
+
+        case (EXECUTE_SUCCESS):
+            return "Executed.";
+
+        case (EXECUTE_DUPLICATE_KEY):
+            return "Error: Duplicate key.";
+
+        case (EXECUTE_TABLE_FULL):
+            return "Error: Table full.";
+
+        case (EXECUTE_TABLE_NOT_EMPTY):
+            return "Error: Table not empty.";
+
+        case (EXECUTE_UNSORTED_INPUT):
+            return "Error: Rows not sorted.";
+
+        case (EXECUTE_INVALID_ROW):
+            return "Error: Invalid row.";
+
+        case (EXECUTE_INDEX_EXISTS):
+            return "Error: Index already exists.";
+
+        case (EXECUTE_UNBOUND_PARAMETER):
+            return "Error: Parameter not bound.";
+
+    }
+
+    return "Error: Unknown result.";
+
+}
+
+/*
+    Prepared statements. A statement is compiled once with `?` 
+    parameters, numbered from 0 in the order they appear, and run any
+    number of times with the values bound in between:
+
+        PreparedStatement* insert = db_prepare("insert ? ? ?", &result);
+        db_bind_id(insert, 0, id);
+        db_bind_text(insert, 1, username);
+        db_bind_text(insert, 2, email);
+        db_execute(table, insert);
+
+    Binding writes the value into the compiled statement; a value 
+    stays bound until it is bound again.
+*/
+PreparedStatement* db_prepare(const char* text, PrepareResult* result) {
+
+    PreparedStatement* prepared = malloc(sizeof(PreparedStatement));
+
+    *result = parse_statement(text, strlen(text), &(prepared->statement));
+
+    if (*result != PREPARE_SUCCESS) {
+        free(prepared);
+        return NULL;
+    }
+
+    Statement* statement = &(prepared->statement);
+
+    // Executing sorts rows and ids, so it runs on copies of them
+    prepared->rows = NULL;
+    prepared->ids = NULL;
+
+    if (statement->num_parameters > 0 && statement->num_rows > 1) {
+        prepared->rows = malloc(statement->num_rows * sizeof(Row));
+    }
+    if (statement->num_parameters > 0 && statement->num_where_ids > 1) {
+        prepared->ids = malloc(statement->num_where_ids * sizeof(uint32_t));
+    }
+
+    return prepared;
+
+}
+
+PrepareResult db_bind_id(PreparedStatement* prepared, uint32_t index, 
+                         uint32_t id) {
+
+    Statement* statement = &(prepared->statement);
+
+    if (index >= statement->num_parameters) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    Parameter* parameter = &(statement->parameters[index]);
+
+    switch (parameter->target) {
+
+        case (PARAMETER_ROW_ID):
+            statement->rows_to_insert[parameter->position].id = id;
+            break;
+
+        case (PARAMETER_WHERE_LOW):
+            statement->where_low = id;
+            break;
+
+        case (PARAMETER_WHERE_HIGH):
+            statement->where_high = id;
+            break;
+
+        case (PARAMETER_WHERE_KEY):
+            statement->where_low = id;
+            statement->where_high = id;
+            break;
+
+        case (PARAMETER_WHERE_ID):
+            statement->where_ids[parameter->position] = id;
+            break;
+
+        default:
+            return PREPARE_SYNTAX_ERROR;
+
+    }
+
+    parameter->bound = true;
+
+    return PREPARE_SUCCESS;
+
+}
+
+PrepareResult db_bind_text(PreparedStatement* prepared, uint32_t index, 
+                           const char* text) {
+
+    Statement* statement = &(prepared->statement);
+
+    if (index >= statement->num_parameters) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    Parameter* parameter = &(statement->parameters[index]);
+    char* value;
+    uint32_t max_length;
+
+    switch (parameter->target) {
+
+        case (PARAMETER_ROW_USERNAME):
+            value = statement->rows_to_insert[parameter->position].username;
+            max_length = COLUMN_USERNAME_SIZE;
+            break;
+
+        case (PARAMETER_ROW_EMAIL):
+            value = statement->rows_to_insert[parameter->position].email;
+            max_length = COLUMN_EMAIL_SIZE;
+            break;
+
+        case (PARAMETER_WHERE_VALUE):
+            value = statement->where_value;
+            max_length = statement->where_column == COLUMN_USERNAME 
+                         ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE;
+            break;
+
+        default:
+            return PREPARE_SYNTAX_ERROR;
+
+    }
+
+    size_t length = strlen(text);
+    if (length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+
+    memcpy(value, text, length + 1);
+    parameter->bound = true;
+
+    return PREPARE_SUCCESS;
+
+}
+
+ExecuteResult db_execute(Table* table, PreparedStatement* prepared) {
+
+    Statement statement = prepared->statement;
+
+    for (uint32_t i = 0; i < statement.num_parameters; i++) {
+        if (!statement.parameters[i].bound) {
+            return EXECUTE_UNBOUND_PARAMETER;
+        }
+    }
+
+    if (prepared->rows != NULL) {
+
+        memcpy(prepared->rows, statement.rows_to_insert, 
+               statement.num_rows * sizeof(Row));
+        statement.rows_to_insert = prepared->rows;
+
+    }
+
+    if (prepared->ids != NULL) {
+
+        memcpy(prepared->ids, statement.where_ids, 
+               statement.num_where_ids * sizeof(uint32_t));
+        statement.where_ids = prepared->ids;
+        statement.num_where_ids = sort_unique_keys(prepared->ids, 
+                                                   statement.num_where_ids);
+
+    }
+
+    return execute_statement(&statement, table);
+
+}
+
+void db_prepared_close(PreparedStatement* prepared) {
+
+    close_statement(&(prepared->statement));
+    free(prepared->rows);
+    free(prepared->ids);
+    free(prepared);
+
+}
+
+/*
+    Thread-safe embedding API. A table opened once may be used by
+    several threads through these functions and execute_statement().
+    Cursors and inserts which fit into their leaf run side by side
+    under the shared tree latch; statements run alone. A thread keeps
+    at most one cursor open, and closes it before it inserts or
+    executes a statement.
+*/
+
+/*
+    Return a cursor at the first row with a key >= the given key,
+    which reads the table while other threads use it
+*/
+Cursor* db_cursor_open(Table* table, uint32_t key) {
+
+    tree_latch_acquire(table, LATCH_READ);
+
+    Cursor* cursor = table_find_latched(table, key, LATCH_READ);
+    cursor_follow_next_leaf(cursor);
+
+    return cursor;
+
+}
+
+void cursor_close(Cursor* cursor) {
+
+    if (cursor->latched) {
+        pager_unfix_page(cursor->table->pager, &cursor->leaf);
+        tree_latch_release(cursor->table);
+    }
+
+    free(cursor);
+
+}
+
+/*
+    Function for a thread to wait until the statements logged so far
+    are durable. The log is synced for every waiting thread by the
+    one which fills the group, by the last of the threads inserting
+    to start waiting, or by a thread which has waited for
+    WAL_GROUP_COMMIT_WAIT_US, whichever comes first. The sync takes
+    the tree latch shared, so no statement truncates the log, and
+    runs without wal_lock, so the next group is logged meanwhile.
+*/
+void wal_wait_durable(Table* table) {
+
+    Pager* pager = table->pager;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += WAL_GROUP_COMMIT_WAIT_US * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&pager->wal_lock);
+
+    uint64_t statement = pager->wal_logged;
+    bool timed_out = false;
+    pager->wal_waiters += 1;
+
+    while (pager->wal_durable < statement) {
+
+        if (pager->wal_syncing) {
+            pthread_cond_wait(&pager->wal_synced, &pager->wal_lock);
+        }
+        else if (timed_out || pager->wal_waiters == pager->wal_writers) {
+            break;
+        }
+        else {
+            timed_out = pthread_cond_timedwait(&pager->wal_synced, 
+                                               &pager->wal_lock,
+                                               &deadline) == ETIMEDOUT;
+        }
+
+    }
+
+    pager->wal_waiters -= 1;
+    bool durable = pager->wal_durable >= statement;
+
+    pthread_mutex_unlock(&pager->wal_lock);
+
+    if (durable) {
+        return;
+    }
+
+    tree_latch_acquire(table, LATCH_READ);
+    pthread_mutex_lock(&pager->wal_lock);
+
+    while (pager->wal_durable < statement) {
+
+        if (pager->wal_syncing) {
+
+            pthread_cond_wait(&pager->wal_synced, &pager->wal_lock);
+            continue;
+
+        }
+
+        wal_write_buffer(pager);
+        uint64_t logged = pager->wal_logged;
+        pager->wal_syncing = true;
+
+        pthread_mutex_unlock(&pager->wal_lock);
+
+        if (fdatasync(pager->wal_file_descriptor) == -1) {
+            printf("Error syncing the log: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&pager->wal_lock);
+
+        pager->wal_syncing = false;
+        if (logged > pager->wal_durable) {
+            pager->wal_durable = logged;
+        }
+        pthread_cond_broadcast(&pager->wal_synced);
+
+    }
+
+    pthread_mutex_unlock(&pager->wal_lock);
+    tree_latch_release(table);
+
+}
+
+/*
+    Function to insert a row while other threads use the table. The
+    insert is tried optimistically, with only the leaf latched for
+    writing. When the leaf has no room for the row, or secondary
+    indexes have to be updated too, it restarts as a statement
+    under the exclusive tree latch, which may split nodes. It
+    returns once the row is durable, sharing the sync of the log
+    with the threads inserting at the same time.
+*/
+ExecuteResult db_insert(Table* table, Row* row) {
+
+    Pager* pager = table->pager;
+    bool optimistic = (pager->mode == PAGER_BUFFER_POOL);
+    bool checkpoint = false;
+    ExecuteResult result = EXECUTE_SUCCESS;
+
+    if (pager->wal_enabled) {
+
+        pthread_mutex_lock(&pager->wal_lock);
+        pager->wal_writers += 1;
+        pthread_mutex_unlock(&pager->wal_lock);
+
+    }
+
+    tree_latch_acquire(table, LATCH_READ);
+
+    PageHandle header_handle;
+    void* header = pager_fix_page(pager, DB_HEADER_PAGE_NUM, LATCH_READ,
+                                  &header_handle);
+
+    for (Column column = COLUMN_USERNAME; column <= COLUMN_EMAIL; column++) {
+        if (*db_header_index_root(header, column) != INVALID_PAGE_NUM) {
+            optimistic = false;
+        }
+    }
+
+    pager_unfix_page(pager, &header_handle);
+
+    if (optimistic) {
+
+        Cursor* cursor = table_find_latched(table, row->id, LATCH_WRITE);
+        void* node = cursor->leaf.data;
+        uint32_t length = serialized_row_size(row);
+
+        if (cursor->cell_num < *leaf_node_num_cells(node) &&
+            *leaf_node_key(node, cursor->cell_num) == row->id) {
+            result = EXECUTE_DUPLICATE_KEY;
+        }
+        else if (leaf_node_has_room(node, length)) {
+
+            uint8_t payload[ROW_MAX_SIZE];
+
+            serialize_row(row, payload);
+            leaf_node_insert_cell(node, cursor->cell_num, row->id, 
+                                  payload, length);
+            pager_mark_fixed_dirty(pager, &cursor->leaf);
+
+        }
+        else {
+            optimistic = false;
+        }
+
+        // The leaf stays pinned until it is logged
+        pager_unlatch_page(&cursor->leaf);
+
+        if (optimistic) {
+            checkpoint = wal_log_pending(pager);
+        }
+
+        pager_unpin_page(pager, &cursor->leaf);
+        free(cursor);
+
+    }
+
+    tree_latch_release(table);
+
+    if (!optimistic) {
+
+        // Restart pessimistically, as a statement
+        Statement statement;
+        statement.type = STATEMENT_INSERT;
+        statement.row_to_insert = *row;
+        statement.rows_to_insert = &statement.row_to_insert;
+        statement.num_rows = 1;
+
+        result = execute_statement(&statement, table);
+
+    }
+    else if (checkpoint) {
+
+        // Checkpoints write frames which other threads may latch
+        tree_latch_acquire(table, LATCH_WRITE);
+
+        if (pager->wal_records >= WAL_CHECKPOINT_RECORDS) {
+            wal_checkpoint(pager);
+        }
+
+        tree_latch_release(table);
+
+    }
+
+    if (pager->wal_enabled) {
+
+        if (result == EXECUTE_SUCCESS) {
+            wal_wait_durable(table);
+        }
+
+        pthread_mutex_lock(&pager->wal_lock);
+        pager->wal_writers -= 1;
+        pthread_mutex_unlock(&pager->wal_lock);
+
+    }
+
+    return result;
+
+}
+
+Pager* pager_open(const char* filename, DbOptions* options) {
+
+    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+    if (fd == -1) {
+        printf("Unable to open file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Pager* pager = malloc(sizeof(Pager));
+    pager->wal_enabled = options->wal;
+
+    if (pager->wal_enabled && options->pager_mode == PAGER_MMAP) {
+        printf("The write-ahead log requires the buffer pool pager.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The log lives next to the db file
+    char wal_filename[strlen(filename) + 5];
+    sprintf(wal_filename, "%s-wal", filename);
+
+    if (!pager->wal_enabled) {
+
+        // A log left by an earlier open with it is still replayed
+        int wal_file_descriptor = open(wal_filename, O_RDWR);
+
+        if (wal_file_descriptor != -1) {
+            wal_recover(fd, wal_file_descriptor);
+            close(wal_file_descriptor);
+        }
+
+    }
+
+    if (pager->wal_enabled) {
+
+        pager->wal_file_descriptor = open(wal_filename, O_RDWR | O_CREAT, 
+                                          S_IWUSR | S_IRUSR);
+        if (pager->wal_file_descriptor == -1) {
+            printf("Unable to open the log file.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        wal_recover(fd, pager->wal_file_descriptor);
+
+        pager->wal_buffer_length = 0;
+        pager->wal_buffer_capacity = 16 * WAL_RECORD_SIZE;
+        pager->wal_buffer = malloc(pager->wal_buffer_capacity);
+        pager->wal_group_commit = options->wal_group_commit;
+        if (pager->wal_group_commit == 0) {
+            pager->wal_group_commit = DEFAULT_WAL_GROUP_COMMIT;
+        }
+        pager->wal_records = 0;
+        pager->num_wal_pending = 0;
+        pager->wal_pending_capacity = 64;
+        pager->wal_pending = malloc(pager->wal_pending_capacity * 
+                                    sizeof(uint32_t));
+        pager->wal_logging_capacity = 64;
+        pager->wal_logging = malloc(pager->wal_logging_capacity * 
+                                    sizeof(uint32_t));
+        pager->wal_logged = 0;
+        pager->wal_durable = 0;
+        pager->wal_writers = 0;
+        pager->wal_waiters = 0;
+        pager->wal_syncing = false;
+
+        // Waits for a sync time out on the monotonic clock
+        pthread_condattr_t synced_attributes;
+        pthread_condattr_init(&synced_attributes);
+        pthread_condattr_setclock(&synced_attributes, CLOCK_MONOTONIC);
+        pthread_cond_init(&pager->wal_synced, &synced_attributes);
+        pthread_condattr_destroy(&synced_attributes);
+
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    pager->mode = options->pager_mode;
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->num_pages = (file_length / PAGE_SIZE);
+
+    if (file_length % PAGE_SIZE != 0) {
+        printf("Db file is not a whole number of pages. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pager->map = NULL;
+    if (pager->mode == PAGER_MMAP) {
+
+        pager->map = mmap(NULL, MMAP_RESERVE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_NORESERVE, fd, 0);
+
+        if (pager->map == MAP_FAILED) {
+            printf("Unable to map file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    pager->pool_size = options->buffer_pool_pages;
+    if (pager->pool_size == 0) {
+        pager->pool_size = DEFAULT_BUFFER_POOL_PAGES;
+    }
+
+    pager->num_frames = 0;
+    pager->frames_capacity = pager->pool_size;
+    pager->frames = malloc(pager->frames_capacity * sizeof(Frame));
+    pager->clock_hand = 0;
+
+    // Power of two buckets, at least two per frame
+    uint32_t num_buckets = 1;
+    while (num_buckets < 2 * pager->pool_size) {
+        num_buckets *= 2;
+    }
+
+    pager->page_table_mask = num_buckets - 1;
+    pager->page_table = malloc(num_buckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        pager->page_table[i] = INVALID_FRAME;
+    }
+
+    pager->pages_read = 0;
+    pager->pages_written = 0;
+
+    // The memory-mapped mode reads and writes through the mapping
+    IoBackend io_backend = options->io_backend;
+    if (pager->mode == PAGER_MMAP) {
+        io_backend = IO_SYNC;
+    }
+    async_io_open(&pager->io, fd, io_backend);
+
+    pthread_mutex_init(&pager->pool_lock, NULL);
+    pthread_mutex_init(&pager->wal_lock, NULL);
+    pthread_cond_init(&pager->frame_loaded, NULL);
+
+    pager->num_statement_pins = 0;
+    pager->statement_pins_capacity = 64;
+    pager->statement_pins = malloc(pager->statement_pins_capacity * 
+                                   sizeof(uint32_t));
+
+    return pager;
+}
+
+/*
+    Open a database file. Options may be NULL to use the defaults
+*/
+Table* db_open(const char* filename, DbOptions* options) {
+
+    DbOptions default_options = { .pager_mode = PAGER_BUFFER_POOL,
+                                  .buffer_pool_pages = DEFAULT_BUFFER_POOL_PAGES,
+                                  .wal = true,
+                                  .wal_group_commit = DEFAULT_WAL_GROUP_COMMIT,
+                                  .io_backend = IO_URING,
+                                  .copy_on_write = false,
+                                  .scan_threads = 0 };
+    if (options == NULL) {
+        options = &default_options;
+    }
+
+    // Copy-on-write mode reads the tree through the memory map
+    DbOptions file_options = *options;
+    if (options->copy_on_write || db_file_copy_on_write(filename)) {
+        file_options.pager_mode = PAGER_MMAP;
+        file_options.wal = false;
+        file_options.copy_on_write = true;
+    }
+    options = &file_options;
+
+    Pager* pager = pager_open(filename, options);
+    
+    Table* table = malloc(sizeof(Table));
+    table->pager = pager;
+    table->sink.format = OUTPUT_TEXT;
+    table->sink.file_descriptor = STDOUT_FILENO;
+    table->sink.buffer = malloc(OUTPUT_BUFFER_SIZE);
+    table->sink.length = 0;
+    table->sink.capacity = OUTPUT_BUFFER_SIZE;
+    table->scan_threads = options->scan_threads;
+    if (table->scan_threads == 0) {
+        table->scan_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    pthread_rwlock_init(&table->tree_latch, NULL);
+    pthread_mutex_init(&table->tree_turnstile, NULL);
+
+    if (pager->num_pages == 0) {
+
+        // New db file. Initialize the header page and a leaf root after it
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_magic(header) = DB_MAGIC;
+        *db_header_root_page(header) = DB_HEADER_PAGE_NUM + 1;
+        for (Column column = COLUMN_ID; column <= COLUMN_EMAIL; column++) {
+            *db_header_index_root(header, column) = INVALID_PAGE_NUM;
+        }
+        *db_header_free_page(header) = DB_HEADER_PAGE_NUM;  // Empty free list
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+
+        void* root_node = get_page(pager, DB_HEADER_PAGE_NUM + 1);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM + 1);
+        pager_commit(pager);
+
+    }
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+
+    if (*db_header_magic(header) != DB_MAGIC) {
+        printf("Not a database file: '%s'.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    table->root_page_num = *db_header_root_page(header);
+    cow_open(table, options->copy_on_write);
+    pager_commit(pager);
+
+    return table;
+
+}
+
+/*
+    Server mode. Clients connect to a Unix domain socket and send
+    requests, each the text of a statement as typed at the prompt:
+        request     uint32_t length, then `length` bytes of text
+        response    uint32_t length of the rest, uint8_t prepare
+                    result, uint8_t execute result, then for a
+                    successful select its rows in the binary output
+                    format
+    Both results are zero on success; the execute result is zero 
+    when the statement could not be prepared. Integers are in host
+    byte order, the socket being local.
+
+    A client may send any number of requests without waiting for
+    the responses. One thread runs an epoll loop over the 
+    connections, executing every complete request received from a
+    connection back to back and sending their responses with one
+    write. A connection whose responses are not all sent is not
+    read from until they are.
+*/
+const uint32_t SERVER_REQUEST_HEADER_SIZE = sizeof(uint32_t);
+const uint32_t SERVER_RESPONSE_HEADER_SIZE = sizeof(uint32_t) + 2;
+
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+void server_watch(Server* server, Connection* connection, uint32_t events) {
+
+    struct epoll_event event = { .events = events, .data.ptr = connection };
+
+    if (epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_MOD,
+                  connection->file_descriptor, &event) == -1) {
+        printf("Error watching connection: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+}
+
+void server_accept(Server* server) {
+
+    while (true) {
+
+        int file_descriptor = accept(server->listen_file_descriptor, NULL, NULL);
+
+        if (file_descriptor == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+            // Out of descriptors or the client went away, try again later
+            return;
+
+        }
+
+        fcntl(file_descriptor, F_SETFL, O_NONBLOCK);
+
+        Connection* connection = malloc(sizeof(Connection));
+        connection->file_descriptor = file_descriptor;
+        connection->input = malloc(SERVER_BUFFER_SIZE);
+        connection->input_length = 0;
+        connection->input_capacity = SERVER_BUFFER_SIZE;
+        connection->output.format = OUTPUT_BINARY;
+        connection->output.file_descriptor = -1;
+        connection->output.buffer = malloc(OUTPUT_BUFFER_SIZE);
+        connection->output.length = 0;
+        connection->output.capacity = OUTPUT_BUFFER_SIZE;
+        connection->output_sent = 0;
+        connection->unsynced = false;
+
+        if (server->num_connections == server->connections_capacity) {
+
+            server->connections_capacity *= 2;
+            server->connections = realloc(server->connections,
+                                          server->connections_capacity * 
+                                          sizeof(Connection*));
+            server->unsynced = realloc(server->unsynced,
+                                       server->connections_capacity *
+                                       sizeof(Connection*));
+
+        }
+        connection->index = server->num_connections;
+        server->connections[server->num_connections++] = connection;
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+        epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_ADD, 
+                  file_descriptor, &event);
+
+    }
+
+}
+
+void server_close_connection(Server* server, Connection* connection) {
+
+    close(connection->file_descriptor);
+
+    if (connection->unsynced) {
+
+        uint32_t i = 0;
+        while (server->unsynced[i] != connection) {
+            i++;
+        }
+        server->unsynced[i] = server->unsynced[--server->num_unsynced];
+
+    }
+
+    Connection* last = server->connections[--server->num_connections];
+    server->connections[connection->index] = last;
+    last->index = connection->index;
+
+    free(connection->input);
+    free(connection->output.buffer);
+    free(connection);
+
+}
+
+/*
+    Function to run one request and append its response to the 
+    output of the connection. The table's sink is swapped for the 
+    connection's while the statement runs, so a select formats its
+    rows straight into the response
+*/
+void server_execute(Server* server, Connection* connection, 
+                    const char* request, uint32_t length) {
+
+    Table* table = server->table;
+    InputBuffer* input_buffer = server->input_buffer;
+
+    if (input_buffer->buffer_length < length + 1) {
+
+        input_buffer->buffer_length = length + 1;
+        input_buffer->buffer = realloc(input_buffer->buffer, length + 1);
+
+    }
+    memcpy(input_buffer->buffer, request, length);
+    input_buffer->buffer[length] = '\0';
+    input_buffer->input_length = length;
+
+    ResultSink* output = &(connection->output);
+    sink_reserve(output, SERVER_RESPONSE_HEADER_SIZE);
+
+    uint32_t header = output->length;
+    output->length += SERVER_RESPONSE_HEADER_SIZE;
+
+    Statement statement;
+    uint8_t prepare_result = prepare_statement(input_buffer, &statement);
+    uint8_t execute_result = 0;
+
+    if (prepare_result == PREPARE_SUCCESS) {
+
+        ResultSink table_sink = table->sink;
+        table->sink = *output;
+
+        execute_result = execute_statement(&statement, table);
+
+        *output = table->sink;
+        table->sink = table_sink;
+        close_statement(&statement);
+
+    }
+
+    uint32_t response_length = output->length - header - sizeof(uint32_t);
+    memcpy(output->buffer + header, &response_length, sizeof(uint32_t));
+    output->buffer[header + sizeof(uint32_t)] = prepare_result;
+    output->buffer[header + sizeof(uint32_t) + 1] = execute_result;
+
 }
 
 /*
-    Print a prompt for the user
+    Function to send the pending responses of a connection. Returns
+    false when the connection has failed
 */
-void print_prompt() {
-    printf("db>");
-}
+bool server_send(Server* server, Connection* connection) {
 
-/*
-    Function to print out the necessary constants
-*/
-void print_constants() {
+    ResultSink* output = &(connection->output);
 
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
-    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    while (connection->output_sent < output->length) {
+
+        ssize_t bytes_sent = send(connection->file_descriptor, 
+                                  output->buffer + connection->output_sent,
+                                  output->length - connection->output_sent,
+                                  MSG_NOSIGNAL);
+
+        if (bytes_sent == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                server_watch(server, connection, EPOLLOUT);
+                return true;
+            }
+            return false;
+
+        }
+
+        connection->output_sent += bytes_sent;
+
+    }
+
+    output->length = 0;
+    connection->output_sent = 0;
+
+    return true;
 
 }
 
 /*
-    Functions to visualize the btree representation
+    Function to run the complete requests received from a connection.
+    Their responses are sent by server_send_synced(), once the log
+    holding their statements is synced. Returns false when the 
+    connection has sent a request over SERVER_MAX_REQUEST_SIZE
 */
-void indent(uint32_t level) {
+bool server_process(Server* server, Connection* connection) {
 
-    for (uint32_t i = 0; i < level; i++) {
-        printf("   ");
-    }
+    uint32_t consumed = 0;
 
-}
+    while (connection->input_length - consumed >= SERVER_REQUEST_HEADER_SIZE) {
 
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+        uint32_t length;
+        memcpy(&length, connection->input + consumed, sizeof(uint32_t));
 
-    void* node = get_page(pager, page_num);
-    uint32_t num_keys, child;
+        if (length > SERVER_MAX_REQUEST_SIZE) {
+            return false;
+        }
 
-    switch (get_node_type(node))
-    {
-        case NODE_INTERNAL:
-           
-            num_keys = *internal_node_num_keys(node);
-            indent(indentation_level);
-            printf("- internal (size %d)\n", num_keys);
+        uint32_t request_size = SERVER_REQUEST_HEADER_SIZE + length;
 
-            for (uint32_t i = 0; i < num_keys; i++) {
+        if (connection->input_length - consumed < request_size) {
 
-                child = *internal_node_child(node, i);
-                print_tree(pager, child, indentation_level + 1);
+            // Room for the rest of a request larger than the buffer
+            if (request_size > connection->input_capacity) {
 
-                indent(indentation_level + 1);
-                printf("- key %d\n", *internal_node_key(node, i));
+                connection->input_capacity = request_size;
+                connection->input = realloc(connection->input, request_size);
 
             }
-
             break;
-        
-        case NODE_LEAF:
 
-            num_keys = *leaf_node_num_cells(node);
-            indent(indentation_level);
-            printf("- leaf node (size %d)\n", num_keys);
+        }
 
-            for (uint32_t i = 0; i < num_keys; i++) {
+        server_execute(server, connection, 
+                       connection->input + consumed + SERVER_REQUEST_HEADER_SIZE,
+                       length);
+        consumed += request_size;
 
-                indent(indentation_level + 1);
-                printf("- key %d\n", *leaf_node_key(node, i));
+    }
 
-            }
+    connection->input_length -= consumed;
+    memmove(connection->input, connection->input + consumed, 
+            connection->input_length);
+
+    if (connection->output.length > 0 && !connection->unsynced) {
+
+        connection->unsynced = true;
+        server->unsynced[server->num_unsynced++] = connection;
 
-            break;
     }
 
+    return true;
+
 }
 
 /*
-    Read input from STDIN
+    Function to send the responses of the requests run since the
+    last call. One sync of the log makes the statements of every
+    connection durable before any of them is acknowledged
 */
-void read_input(InputBuffer* input_buffer) {
+void server_send_synced(Server* server) {
 
-    ssize_t bytes_read = getline(&(input_buffer->buffer), 
-                            &(input_buffer->buffer_length), stdin);
+    if (server->num_unsynced == 0) {
+        return;
+    }
 
-    if (bytes_read <= 0) {
-        
-        printf("Error reading input\n");
-        exit(EXIT_FAILURE);
+    db_sync(server->table);
 
+    uint32_t num_unsynced = server->num_unsynced;
+    server->num_unsynced = 0;
+
+    for (uint32_t i = 0; i < num_unsynced; i++) {
+        server->unsynced[i]->unsynced = false;
     }
 
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = 0;
-}
+    for (uint32_t i = 0; i < num_unsynced; i++) {
 
-/* 
-    Function to free allocated memory for the instance of InputBuffer
-*/
-void close_input_buffer(InputBuffer* input_buffer) {
+        Connection* connection = server->unsynced[i];
 
-    free(input_buffer->buffer);
-    free(input_buffer);
+        if (!server_send(server, connection)) {
+            server_close_connection(server, connection);
+        }
+
+    }
 
 }
 
 /*
-    Function to flush the data at the end of the db file
-    Takes up the complete page, even it's not full
+    Function to handle an event of a connection, returns false when
+    it should be closed
 */
-void* pager_flush(Pager* pager, uint32_t page_num) {
+bool server_handle(Server* server, Connection* connection, uint32_t events) {
 
-    if (pager->pages[page_num] == NULL) {
-
-        printf("Tried to flush null page.\n");
-        exit(EXIT_FAILURE);
+    if (events & EPOLLOUT) {
 
-    }
+        if (!server_send(server, connection)) {
+            return false;
+        }
+        if (connection->output.length > 0) {
+            return true;
+        }
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+        // Sent in full, so requests received meanwhile can run
+        server_watch(server, connection, EPOLLIN);
+        return server_process(server, connection);
 
-    if (offset == -1) {
+    }
 
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+    ssize_t bytes_read = recv(connection->file_descriptor,
+                              connection->input + connection->input_length,
+                              connection->input_capacity - connection->input_length,
+                              0);
 
+    if (bytes_read == -1) {
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if (bytes_read == 0) {
+        return false;
     }
 
-    ssize_t bytes_written = 
-        write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    
-    if (bytes_written == -1) {
+    connection->input_length += bytes_read;
 
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
-    
-    }
+    return server_process(server, connection);
 
 }
 
 /*
-    Flush page cache to disk, close the file, free memory for
-    the pager and Table data structures
+    Function to serve the table on a Unix domain socket at `path` 
+    until SIGINT or SIGTERM. A file left at the path by an earlier
+    server is replaced
 */
-void db_close(Table* table) {
-    
-    Pager* pager = table->pager;
-
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
+void db_serve(Table* table, const char* path) {
 
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
 
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long: '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    Server server;
+    server.table = table;
+    server.input_buffer = new_input_buffer();
+    server.connections_capacity = 16;
+    server.connections = malloc(server.connections_capacity * sizeof(Connection*));
+    server.num_connections = 0;
+    server.unsynced = malloc(server.connections_capacity * sizeof(Connection*));
+    server.num_unsynced = 0;
+    server.listen_file_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    unlink(path);
+
+    if (server.listen_file_descriptor == -1 ||
+        bind(server.listen_file_descriptor, (struct sockaddr*)&address,
+             sizeof(address)) == -1 ||
+        listen(server.listen_file_descriptor, SOMAXCONN) == -1) {
+
+        printf("Unable to listen on '%s': %d\n", path, errno);
+        exit(EXIT_FAILURE);
 
     }
+    fcntl(server.listen_file_descriptor, F_SETFL, O_NONBLOCK);
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
+    server.epoll_file_descriptor = epoll_create1(0);
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(server.epoll_file_descriptor, EPOLL_CTL_ADD, 
+              server.listen_file_descriptor, &listen_event);
 
-        printf("Error closing the db file.\n");
-        exit(EXIT_FAILURE);
+    /*
+        The signals are blocked except while waiting for events, so
+        a stop request is not lost between checking and waiting
+    */
+    sigset_t stop_signals, wait_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, &wait_signals);
+    sigdelset(&wait_signals, SIGINT);
+    sigdelset(&wait_signals, SIGTERM);
 
-    }
+    struct sigaction action = { .sa_handler = server_stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
 
-        void* page = pager->pages[i];
-        if (page) {
+    while (!server_stopping) {
+
+        int num_events = epoll_pwait(server.epoll_file_descriptor, events, 
+                                     SERVER_MAX_EVENTS, -1, &wait_signals);
+
+        if (num_events == -1) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Error waiting for events: %d\n", errno);
+            exit(EXIT_FAILURE);
 
-            free(page);
-            pager->pages[i] = NULL;
-        
         }
-    
+
+        for (int i = 0; i < num_events; i++) {
+
+            Connection* connection = events[i].data.ptr;
+
+            if (connection == NULL) {
+                server_accept(&server);
+            }
+            else if (!server_handle(&server, connection, events[i].events)) {
+                server_close_connection(&server, connection);
+            }
+
+        }
+
+        server_send_synced(&server);
+
     }
 
-    free(pager);
-    free(table);
+    while (server.num_connections > 0) {
+        server_close_connection(&server, server.connections[0]);
+    }
+
+    close(server.epoll_file_descriptor);
+    close(server.listen_file_descriptor);
+    unlink(path);
+    free(server.connections);
+    free(server.unsynced);
+    close_input_buffer(server.input_buffer);
+
 }
 
 /*
-    Wrapper that handles non-SQL commands like '.exit' and leaves room for more 
-    such commands
+    Batch mode. A script runs with a statement or meta command per
+    line and no prompts or acknowledgements; only select results, 
+    errors with their line number and a summary at the end are 
+    printed. Blank lines and lines starting with `--` are skipped, 
+    and `.exit` ends the script.
+
+    A script in a regular file is mapped and each line compiled 
+    where it lies in the mapping. Other input, such as a pipe, is
+    read in large chunks and its lines compiled where they lie in
+    the buffer.
 */
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+void batch_run_line(Batch* batch, const char* line, uint32_t length) {
 
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    }
+    batch->line_number += 1;
 
-    else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
-        return META_COMMAND_SUCCESS;
+    while (length > 0 && lexer_is_space(*line)) {
+        line++;
+        length--;
     }
-
-    else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-        printf("Constants:\n");
-        print_constants();
-        return META_COMMAND_SUCCESS;
+    while (length > 0 && lexer_is_space(line[length - 1])) {
+        length--;
     }
 
-    else {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    if (length == 0 || (length >= 2 && line[0] == '-' && line[1] == '-')) {
+        return;
     }
 
-}
+    if (line[0] == '.') {
 
-/* 
-    SQL compiler
-*/
+        if (length == 5 && memcmp(line, ".exit", 5) == 0) {
+            batch->stopped = true;
+            return;
+        }
 
-/*
-Function to handle the compiliing of the insert statements
-*/
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
+        // Meta commands are rare, they read a copy ending in a null
+        InputBuffer* input_buffer = batch->input_buffer;
+        if (input_buffer->buffer_length < length + 1) {
 
-    statement->type = STATEMENT_INSERT;
+            input_buffer->buffer_length = length + 1;
+            input_buffer->buffer = realloc(input_buffer->buffer, length + 1);
 
-    char* keyword = strtok(input_buffer->buffer, " ");
-    char* id_string = strtok(NULL, " "); 
-    char* username = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
+        }
+        memcpy(input_buffer->buffer, line, length);
+        input_buffer->buffer[length] = '\0';
+        input_buffer->input_length = length;
 
-    if (id_string == NULL || username == NULL || email == NULL) {
-        return PREPARE_SYNTAX_ERROR;
-    }
+        if (do_meta_command(input_buffer, batch->table) == 
+            META_COMMAND_UNRECOGNIZED_COMMAND) {
+
+            printf("Line %u: Unrecognized command '%s'.\n", 
+                   batch->line_number, input_buffer->buffer);
+            batch->failed += 1;
+
+        }
+        return;
 
-    int id = atoi(id_string);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
-    }
-    if (strlen(username) > COLUMN_USERNAME_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
     }
-    if (strlen(email) > COLUMN_EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+
+    Statement statement;
+    PrepareResult prepare_result = parse_statement(line, length, &statement);
+
+    if (prepare_result == PREPARE_SUCCESS && statement.num_parameters > 0) {
+        close_statement(&statement);
+        prepare_result = PREPARE_SYNTAX_ERROR;
     }
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+    batch->statements += 1;
 
-    return PREPARE_SUCCESS;
+    if (prepare_result != PREPARE_SUCCESS) {
 
-}
+        printf("Line %u: %s\n", batch->line_number, 
+               prepare_result_message(prepare_result));
+        batch->failed += 1;
+        return;
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, 
-                                Statement* statement) {
-    
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
     }
 
-    if (strcmp(input_buffer->buffer, "select") == 0) {
+    ExecuteResult execute_result = execute_statement(&statement, batch->table);
 
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+    if (execute_result != EXECUTE_SUCCESS) {
+
+        printf("Line %u: %s\n", batch->line_number, 
+               execute_result_message(execute_result));
+        batch->failed += 1;
 
     }
 
-    return PREPARE_UNRECOGNIZED_STATEMENT;
+    close_statement(&statement);
 
 }
 
-ExecuteResult execute_insert(Statement* statement, Table* table) {
+/*
+    Function to run the complete lines of `data`, and the last line
+    without a newline too when `at_end` is set. Returns the bytes
+    consumed
+*/
+size_t batch_run_lines(Batch* batch, const char* data, size_t length,
+                       bool at_end) {
 
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-    
-    Row* row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table, key_to_insert);
+    size_t position = 0;
 
-    if (cursor->cell_num < num_cells) {
-        
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
+    while (position < length && !batch->stopped) {
+
+        const char* newline = memchr(data + position, '\n', length - position);
+
+        if (newline == NULL && !at_end) {
+            break;
         }
-    
-    }
 
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
+        size_t line_end = newline != NULL ? (size_t)(newline - data) : length;
 
-    free(cursor);
+        if (line_end - position > UINT32_MAX) {
+            printf("Line %u is too long.\n", batch->line_number + 1);
+            exit(EXIT_FAILURE);
+        }
 
-    return EXECUTE_SUCCESS;
+        batch_run_line(batch, data + position, line_end - position);
+        position = newline != NULL ? line_end + 1 : length;
 
-}
+    }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
+    return position;
 
-    Row row;
-    Cursor* cursor = table_start(table);
-   
-    while (!cursor->end_of_table) {
+}
 
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+/*
+    Function to run the script read from `file_descriptor`. Returns 
+    the number of statements and meta commands which failed
+*/
+uint64_t db_run_script(Table* table, int file_descriptor) {
 
-    }
+    Batch batch = { .table = table, .input_buffer = new_input_buffer(),
+                    .line_number = 0, .statements = 0, .failed = 0,
+                    .stopped = false };
 
-    free(cursor);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    return EXECUTE_SUCCESS;
+    struct stat file_stat;
 
-}
+    if (fstat(file_descriptor, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+        file_stat.st_size > 0) {
 
-ExecuteResult execute_statement(Statement* statement, Table* table) {
+        char* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE,
+                          file_descriptor, 0);
 
-    switch(statement->type) {
+        if (data == MAP_FAILED) {
+            printf("Error mapping the script: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
 
-        case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
+        batch_run_lines(&batch, data, file_stat.st_size, true);
+        munmap(data, file_stat.st_size);
 
-        case (STATEMENT_SELECT):
-            return execute_select(statement, table);
     }
+    else {
 
-}
+        size_t capacity = BATCH_BUFFER_SIZE;
+        size_t length = 0;
+        char* buffer = malloc(capacity);
 
-Pager* pager_open(const char* filename) {
+        while (!batch.stopped) {
 
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+            // A line longer than the buffer makes it grow
+            if (length == capacity) {
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+            }
 
-    if (fd == -1) {
-        printf("Unable to open file.\n");
-        exit(EXIT_FAILURE);
-    }
+            ssize_t bytes_read = read(file_descriptor, buffer + length, 
+                                      capacity - length);
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
+            if (bytes_read == -1) {
 
-    Pager* pager = malloc(sizeof(Pager));
-    pager->file_descriptor = fd;
-    pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
+                if (errno == EINTR) {
+                    continue;
+                }
 
-    if (file_length % PAGE_SIZE != 0) {
-        printf("Db file is not a whole number of pages. Corrupt file.\n");
-        exit(EXIT_FAILURE);
-    }
+                printf("Error reading the script: %d\n", errno);
+                exit(EXIT_FAILURE);
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+            }
 
-        pager->pages[i] = NULL;
+            length += bytes_read;
 
-    }
+            size_t consumed = batch_run_lines(&batch, buffer, length, 
+                                              bytes_read == 0);
+            length -= consumed;
+            memmove(buffer, buffer + consumed, length);
 
-    return pager;
-}
+            if (bytes_read == 0) {
+                break;
+            }
 
-Table* db_open(const char* filename) {
+        }
 
-    Pager* pager = pager_open(filename);
-    
-    Table* table = malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
+        free(buffer);
 
-    if (pager->num_pages == 0) {
-        // New db file. Initialize page 0 as the leaf node
-        void* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
     }
 
-    return table;
+    // The summary is only printed once the script is durable
+    db_sync(table);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + 
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
 
-}
\ No newline at end of file
+    printf("Ran %lu statements from %u lines in %.3f s, %lu failed.\n",
+           batch.statements, batch.line_number, seconds, batch.failed);
+
+    close_input_buffer(batch.input_buffer);
+
+    return batch.failed;
+
+}
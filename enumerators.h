@@ -14,29 +14,123 @@ enum PrepareResult_t {
     PREPARE_NEGATIVE_ID,
     PREPARE_SYNTAX_ERROR,
     PREPARE_STRING_TOO_LONG,
-    PREPARE_UNRECOGNIZED_STATEMENT
+    PREPARE_UNRECOGNIZED_STATEMENT,
+    PREPARE_ID_TOO_LARGE
 };
 
 typedef enum PrepareResult_t PrepareResult;
 
 enum StatementType_t {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_CREATE_INDEX
 };
 
 typedef enum StatementType_t StatementType;
 
+enum WhereType_t {
+    WHERE_NONE,
+    WHERE_ID_BETWEEN,
+    WHERE_COLUMN_EQUALS,
+    WHERE_ID_IN
+};
+
+typedef enum WhereType_t WhereType;
+
+enum TokenType_t {
+    TOKEN_WORD,
+    TOKEN_NUMBER,
+    TOKEN_PARAMETER,
+    TOKEN_EQUALS,
+    TOKEN_COMMA,
+    TOKEN_LEFT_PAREN,
+    TOKEN_RIGHT_PAREN,
+    TOKEN_END
+};
+
+typedef enum TokenType_t TokenType;
+
+// Field of a statement the value of a parameter is bound to
+enum ParameterTarget_t {
+    PARAMETER_ROW_ID,
+    PARAMETER_ROW_USERNAME,
+    PARAMETER_ROW_EMAIL,
+    PARAMETER_WHERE_LOW,
+    PARAMETER_WHERE_HIGH,
+    PARAMETER_WHERE_KEY,        // Both bounds, for delete where id = ?
+    PARAMETER_WHERE_ID,
+    PARAMETER_WHERE_VALUE
+};
+
+typedef enum ParameterTarget_t ParameterTarget;
+
+enum Column_t {
+    COLUMN_ID,
+    COLUMN_USERNAME,
+    COLUMN_EMAIL
+};
+
+typedef enum Column_t Column;
+
+enum Aggregate_t {
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN_ID,
+    AGGREGATE_MAX_ID
+};
+
+typedef enum Aggregate_t Aggregate;
+
 enum ExecuteResult_t {
     EXECUTE_SUCCESS,
     EXECUTE_DUPLICATE_KEY,
-    EXECUTE_TABLE_FULL
+    EXECUTE_TABLE_FULL,
+    EXECUTE_TABLE_NOT_EMPTY,
+    EXECUTE_UNSORTED_INPUT,
+    EXECUTE_INVALID_ROW,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_UNBOUND_PARAMETER
 };
 
 typedef enum ExecuteResult_t ExecuteResult;
 
 enum NodeType_t {
     NODE_INTERNAL,
-    NODE_LEAF
+    NODE_LEAF,
+    NODE_INDEX_INTERNAL,
+    NODE_INDEX_LEAF,
+    NODE_FREE
+};
+
+typedef enum NodeType_t NodeType;
+
+enum PagerMode_t {
+    PAGER_BUFFER_POOL,
+    PAGER_MMAP
+};
+
+typedef enum PagerMode_t PagerMode;
+
+enum IoBackend_t {
+    IO_URING,
+    IO_THREADS,
+    IO_SYNC
+};
+
+typedef enum IoBackend_t IoBackend;
+
+enum LatchMode_t {
+    LATCH_READ,
+    LATCH_WRITE
+};
+
+typedef enum LatchMode_t LatchMode;
+
+enum OutputFormat_t {
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_TSV,
+    OUTPUT_BINARY
 };
 
-typedef enum NodeType_t NodeType;
\ No newline at end of file
+typedef enum OutputFormat_t OutputFormat;
\ No newline at end of file
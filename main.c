@@ -4,9 +4,20 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
 #include "db.h"
 
 /*
@@ -22,7 +33,105 @@ int main (int argc, char *argv[]) {
     }
     
     char* filename = argv[1];
-    Table* table = db_open(filename);
+    DbOptions options = { .pager_mode = PAGER_BUFFER_POOL,
+                          .buffer_pool_pages = DEFAULT_BUFFER_POOL_PAGES,
+                          .wal = true,
+                          .wal_group_commit = DEFAULT_WAL_GROUP_COMMIT,
+                          .io_backend = IO_URING,
+                          .copy_on_write = false,
+                          .scan_threads = 0 };
+
+    OutputFormat output_format = OUTPUT_TEXT;
+    char* socket_path = NULL;
+    char* script_path = NULL;
+    bool group_commit = false;
+
+    for (int i = 2; i < argc; i++) {
+
+        if (strcmp(argv[i], "--pool-pages") == 0 && i + 1 < argc) {
+            options.buffer_pool_pages = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mmap") == 0) {
+            // The kernel may write mapped pages back at any time
+            options.pager_mode = PAGER_MMAP;
+            options.wal = false;
+        }
+        else if (strcmp(argv[i], "--cow") == 0) {
+            // Snapshots read the tree through the memory map
+            options.pager_mode = PAGER_MMAP;
+            options.wal = false;
+            options.copy_on_write = true;
+        }
+        else if (strcmp(argv[i], "--no-wal") == 0) {
+            options.wal = false;
+        }
+        else if (strcmp(argv[i], "--group-commit") == 0 && i + 1 < argc) {
+            options.wal_group_commit = atoi(argv[++i]);
+            group_commit = true;
+        }
+        else if (strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc) {
+            options.scan_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            script_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc &&
+                 parse_io_backend(argv[i + 1], &options.io_backend)) {
+            i++;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc &&
+                 parse_output_format(argv[i + 1], &output_format)) {
+            i++;
+        }
+        else {
+            printf("Unrecognized option '%s'.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    // The memory-mapped pager writes without the log
+    if (options.pager_mode == PAGER_MMAP && group_commit) {
+        printf("--group-commit needs the write-ahead log, which --mmap and --cow run without.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Table* table = db_open(filename, &options);
+    table->sink.format = output_format;
+
+    if (socket_path != NULL) {
+
+        db_serve(table, socket_path);
+        db_close(table);
+        return 0;
+
+    }
+
+    // A script, or input which is not a terminal, runs in batch mode
+    if (script_path != NULL || !isatty(STDIN_FILENO)) {
+
+        int script = STDIN_FILENO;
+
+        if (script_path != NULL) {
+
+            script = open(script_path, O_RDONLY);
+
+            if (script == -1) {
+                printf("Unable to open '%s'.\n", script_path);
+                exit(EXIT_FAILURE);
+            }
+
+        }
+
+        uint64_t failed = db_run_script(table, script);
+        db_close(table);
+
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    }
 
     InputBuffer* input_buffer = new_input_buffer();
 
@@ -47,45 +156,24 @@ int main (int argc, char *argv[]) {
         }
 
         Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-
-            case (PREPARE_SUCCESS):
-                break;
-
-            case (PREPARE_NEGATIVE_ID):
-                printf("ID cannot be negative.\n");
-                continue;
-
-            case (PREPARE_SYNTAX_ERROR):
-                printf("Syntax error. Could not parse statement.\n");
-                continue;
-            
-            case (PREPARE_STRING_TOO_LONG):
-                printf("String is too long.\n");
-                continue;
-
-            case (PREPARE_UNRECOGNIZED_STATEMENT):
-                printf("Unrecognized keyword as start of '%s'.\n", 
-                        input_buffer->buffer);
-                continue;
+        PrepareResult prepare_result = prepare_statement(input_buffer, &statement);
 
+        if (prepare_result == PREPARE_UNRECOGNIZED_STATEMENT) {
+            printf("Unrecognized keyword as start of '%s'.\n", 
+                    input_buffer->buffer);
+            continue;
+        }
+        if (prepare_result != PREPARE_SUCCESS) {
+            printf("%s\n", prepare_result_message(prepare_result));
+            continue;
         }
 
-        switch (execute_statement(&statement, table)) {
-
-            case (EXECUTE_SUCCESS):
-                printf("Executed.\n");
-                break;
-
-            case (EXECUTE_DUPLICATE_KEY):
-                printf("Error: Duplicate key.\n");
-                break;
-
-            case (EXECUTE_TABLE_FULL):
-                printf("Error: Table full.\n");
-                break;
+        // A statement is only acknowledged once it is durable
+        ExecuteResult execute_result = execute_statement(&statement, table);
+        db_sync(table);
+        printf("%s\n", execute_result_message(execute_result));
 
-        }
+        close_statement(&statement);
 
     }
 